@@ -0,0 +1,121 @@
+/*
+ * HW01, lazy functional library - heap allocation counter for tests and benchmarks
+ * Author: David Kuťák, 433409
+ *
+ * Replaces global operator new/delete, so it has to be included in exactly one translation unit of a program
+ * Counters are per thread, allocations made by other threads are not visible
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace allocation
+{
+
+struct Counts
+{
+    std::size_t allocations;
+    std::size_t bytes;
+    std::size_t deallocations;
+};
+
+namespace detail
+{
+thread_local std::size_t tAllocations = 0;
+thread_local std::size_t tBytes = 0;
+thread_local std::size_t tDeallocations = 0;
+}
+
+/**
+ * Allocations and deallocations done by current thread since its start
+ */
+Counts current()
+{
+    return {detail::tAllocations, detail::tBytes, detail::tDeallocations};
+}
+
+/**
+ * Counts allocations and deallocations done by current thread since construction
+ */
+class Scope
+{
+    private:
+    Counts mStart;
+
+    public:
+    Scope()
+        :mStart(current())
+    { }
+
+    Counts counts() const
+    {
+        auto now = current();
+        return {now.allocations - mStart.allocations, now.bytes - mStart.bytes, now.deallocations - mStart.deallocations};
+    }
+
+    std::size_t allocations() const
+    {
+        return counts().allocations;
+    }
+
+    std::size_t bytes() const
+    {
+        return counts().bytes;
+    }
+
+    std::size_t deallocations() const
+    {
+        return counts().deallocations;
+    }
+};
+
+}
+
+// Replacements are defined in the same translation unit as their callers, after inlining GCC would
+// report free() of memory returned by operator new
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size)
+{
+    ++allocation::detail::tAllocations;
+    allocation::detail::tBytes += size;
+    if(void* ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    return ::operator new(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    if(ptr)
+        ++allocation::detail::tDeallocations;
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    ::operator delete(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    ::operator delete(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept
+{
+    ::operator delete(ptr);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
@@ -0,0 +1,514 @@
+/*
+ * HW01, lazy functional library - microbenchmarks
+ * Author: David Kuťák, 433409
+ *
+ * Build: g++ -std=c++14 -O2 -DNDEBUG bench.cpp -o bench
+ * Usage: ./bench [--max-scale N] [--filter substring] [--warmup N] [--samples N] > bench_output.txt
+ * Gate:  ./bench --baseline benchBaseline.json [--threshold 0.25] [--absolute] (at least 11 samples are taken)
+ *
+ * Every benchmark is measured for lazy.h and for equivalent hand-written loop,
+ * results are printed as JSON (median and MAD of ns per element and of ratio lazy/hand-written,
+ * heap allocations per element)
+ * With baseline given, exit code is 1 when any benchmark regressed against it
+ */
+#include "lazy.h"
+#include "lazyAny.h"
+#include "allocationCounter.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace bench
+{
+
+/**
+ * Prevents compiler from optimizing computation of value away
+ */
+template<typename T>
+void keep(const T& value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+struct Benchmark
+{
+    std::string name;
+    std::size_t elements;
+    std::function<void()> lazy;
+    std::function<void()> handWritten;
+    /**
+     * Single operations take around nanosecond and their timing depends on code alignment,
+     * so they are reported but not compared against baseline
+     */
+    bool gated = true;
+};
+
+struct Stats
+{
+    double median;
+    double mad;
+};
+
+struct Result
+{
+    std::string name;
+    std::size_t elements;
+    Stats lazy;
+    Stats handWritten;
+    Stats ratio;
+    double lazyAllocations;
+    double lazyBytes;
+    double handWrittenAllocations;
+};
+
+/**
+ * Times of runs after warmup, in nanoseconds per element
+ */
+std::vector<double> sample(const std::function<void()>& fn, std::size_t elements, int warmup, int samples)
+{
+    for(int i = 0; i < warmup; ++i)
+        fn();
+    std::vector<double> times;
+    for(int i = 0; i < samples; ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        auto stop = std::chrono::steady_clock::now();
+        times.push_back(std::chrono::duration<double, std::nano>(stop - start).count() / static_cast<double>(std::max<std::size_t>(elements, 1)));
+    }
+    return times;
+}
+
+double median(std::vector<double> values)
+{
+    if(values.empty())
+        return 0;
+    auto middle = values.begin() + values.size() / 2;
+    std::nth_element(values.begin(), middle, values.end());
+    if(values.size() % 2)
+        return *middle;
+    return (*middle + *std::max_element(values.begin(), middle)) / 2;
+}
+
+/**
+ * Median and median absolute deviation
+ */
+Stats stats(const std::vector<double>& values)
+{
+    double m = median(values);
+    std::vector<double> deviations;
+    for(double v : values)
+        deviations.push_back(std::abs(v - m));
+    return {m, median(deviations)};
+}
+
+/**
+ * Lazy and hand-written samples are interleaved, so both see the same machine state
+ * Heap allocations are counted over all samples
+ */
+Result run(const Benchmark& b, int warmup, int samples)
+{
+    std::vector<double> lazyTimes, handTimes, ratios;
+    sample(b.lazy, b.elements, warmup, 0);
+    sample(b.handWritten, b.elements, warmup, 0);
+    allocation::Counts lazyCounts {0, 0, 0}, handCounts {0, 0, 0};
+    for(int i = 0; i < samples; ++i)
+    {
+        allocation::Scope lazyScope;
+        lazyTimes.push_back(sample(b.lazy, b.elements, 0, 1).front());
+        lazyCounts.allocations += lazyScope.allocations();
+        lazyCounts.bytes += lazyScope.bytes();
+
+        allocation::Scope handScope;
+        handTimes.push_back(sample(b.handWritten, b.elements, 0, 1).front());
+        handCounts.allocations += handScope.allocations();
+
+        ratios.push_back(handTimes.back() > 0 ? lazyTimes.back() / handTimes.back() : 0);
+    }
+    double perElement = 1.0 / (static_cast<double>(samples) * static_cast<double>(std::max<std::size_t>(b.elements, 1)));
+    return {b.name, b.elements, stats(lazyTimes), stats(handTimes), stats(ratios),
+            lazyCounts.allocations * perElement, lazyCounts.bytes * perElement, handCounts.allocations * perElement};
+}
+
+void printJson(const std::vector<Result>& results, std::ostream& out)
+{
+    out << "{\n  \"benchmarks\": [\n";
+    for(std::size_t i = 0; i < results.size(); ++i)
+    {
+        const auto& r = results[i];
+        out << "    {\"name\": \"" << r.name << "\", \"elements\": " << r.elements
+            << ", \"lazy_ns_per_element\": " << r.lazy.median << ", \"lazy_mad\": " << r.lazy.mad
+            << ", \"hand_written_ns_per_element\": " << r.handWritten.median << ", \"hand_written_mad\": " << r.handWritten.mad
+            << ", \"ratio\": " << r.ratio.median << ", \"ratio_mad\": " << r.ratio.mad
+            << ", \"lazy_allocations_per_element\": " << r.lazyAllocations << ", \"lazy_bytes_per_element\": " << r.lazyBytes
+            << ", \"hand_written_allocations_per_element\": " << r.handWrittenAllocations << "}"
+            << (i + 1 == results.size() ? "\n" : ",\n");
+    }
+    out << "  ]\n}\n";
+}
+
+/**
+ * Reads baseline written by printJson (one benchmark per line)
+ */
+std::map<std::string, Result> readBaseline(std::istream& in)
+{
+    auto field = [](const std::string& line, const std::string& key) {
+        auto pos = line.find("\"" + key + "\": ");
+        return pos == std::string::npos ? 0.0 : std::strtod(line.c_str() + pos + key.size() + 4, nullptr);
+    };
+
+    std::map<std::string, Result> baseline;
+    std::string line;
+    while(std::getline(in, line))
+    {
+        auto pos = line.find("\"name\": \"");
+        if(pos == std::string::npos)
+            continue;
+        pos += 9;
+        Result r;
+        r.name = line.substr(pos, line.find('"', pos) - pos);
+        r.elements = static_cast<std::size_t>(field(line, "elements"));
+        r.lazy = {field(line, "lazy_ns_per_element"), field(line, "lazy_mad")};
+        r.handWritten = {field(line, "hand_written_ns_per_element"), field(line, "hand_written_mad")};
+        r.ratio = {field(line, "ratio"), field(line, "ratio_mad")};
+        baseline[r.name] = r;
+    }
+    return baseline;
+}
+
+/**
+ * Median and MAD of fewer samples are too noisy to be compared against baseline
+ */
+constexpr int gateSamples = 11;
+
+/**
+ * Benchmark regressed when its median is worse than baseline by more than threshold (relative)
+ * and the difference is above noise (3 MADs of both measurements)
+ * By default ratio lazy/hand-written is compared, so the baseline is portable between machines,
+ * absolute compares lazy ns per element
+ */
+bool regressed(const Result& current, const Result& base, double threshold, bool absolute)
+{
+    const Stats& now = absolute ? current.lazy : current.ratio;
+    const Stats& then = absolute ? base.lazy : base.ratio;
+    double difference = now.median - then.median;
+    return difference > threshold * then.median && difference > 3 * (now.mad + then.mad);
+}
+
+/**
+ * Same generator as in studentExtraTests.cpp: 1, 1 2, 1 2 3, ...
+ */
+struct SequenceGenerator {
+
+    struct iterator : std::iterator< std::forward_iterator_tag, int, std::ptrdiff_t, const int *, const int & > {
+        iterator() :
+            _value( 1 ),
+            _sequence( 1 ),
+            _limit( 0 )
+        {}
+        iterator( int limit ) :
+            _value( 0 ),
+            _sequence( 0 ),
+            _limit( limit )
+        {}
+
+        const int &operator*() const {
+            return _value;
+        }
+        iterator &operator++() {
+            ++_limit;
+            ++_value;
+            if ( _value > _sequence ) {
+                ++_sequence;
+                _value = 1;
+            }
+            return *this;
+        }
+        bool operator==( const iterator &other ) const {
+            return _limit == other._limit;
+        }
+        bool operator!=( const iterator &other ) const {
+            return _limit != other._limit;
+        }
+
+    private:
+        int _value;
+        int _sequence;
+        int _limit;
+    };
+
+    SequenceGenerator( int stop ) :
+        _stop( stop )
+    {}
+
+    iterator begin() const {
+        return iterator();
+    }
+    iterator end() const {
+        return iterator( _stop );
+    }
+
+private:
+    int _stop;
+};
+
+/**
+ * Words from complexTests.cpp repeated to given count
+ */
+std::vector<std::string> makeWords(std::size_t count)
+{
+    const std::vector<std::string> base {"hi", "hello", "world", "terrible", "a", "I", "piggy", "car", "left", "a"};
+    std::vector<std::string> words;
+    words.reserve(count);
+    for(std::size_t i = 0; i < count; ++i)
+        words.push_back(base[i % base.size()]);
+    return words;
+}
+
+/**
+ * Iterator operations measured separately: ++ alone, ++ with *, ++ with ==
+ * Counters and iterators are kept in every step, so the loops cannot be collapsed by compiler
+ */
+template<typename MakeRange, typename Increment, typename Dereference, typename Compare>
+void addOperations(std::vector<Benchmark>& list, const std::string& stage, std::size_t n, MakeRange makeRange,
+                   Increment handIncrement, Dereference handDereference, Compare handCompare)
+{
+    list.push_back({stage + "/increment", n,
+                    [=]{auto r = makeRange(); auto it = r.begin(); for(std::size_t i = 0; i < n; ++i) {++it; keep(it);} },
+                    handIncrement, false});
+    list.push_back({stage + "/increment_dereference", n,
+                    [=]{auto r = makeRange(); auto it = r.begin(); for(std::size_t i = 0; i < n; ++i, ++it) keep(*it);},
+                    handDereference, false});
+    list.push_back({stage + "/increment_compare", n,
+                    [=]{auto r = makeRange(); auto it = r.begin(); auto end = r.end(); std::size_t c = 0; for(; it != end; ++it) {++c; keep(c);} },
+                    handCompare, false});
+}
+
+std::vector<Benchmark> benchmarks(std::size_t maxScale)
+{
+    std::vector<Benchmark> list;
+
+    const std::size_t n = 1000 * 1000;
+    auto data = std::make_shared<std::vector<int>>(n);
+    for(std::size_t i = 0; i < n; ++i)
+        (*data)[i] = static_cast<int>(i % 1000);
+
+    // MapIt
+    addOperations(list, "map", n,
+        [data]{return lazy::map(data->begin(), data->end(), [](int x){return x * 3 + 1;});},
+        [data, n]{auto it = data->begin(); for(std::size_t i = 0; i < n; ++i) {++it; keep(it);} },
+        [data, n]{auto it = data->begin(); for(std::size_t i = 0; i < n; ++i, ++it) keep(*it * 3 + 1);},
+        [data]{std::size_t c = 0; for(auto it = data->begin(); it != data->end(); ++it) {++c; keep(c);} });
+
+    // FilterIt - every other element passes
+    addOperations(list, "filter", n / 2,
+        [data]{return lazy::filter(data->begin(), data->end(), [](int x){return x % 2 == 0;});},
+        [data, n]{std::size_t c = 0; for(auto it = data->begin(); it != data->end() && c < n / 2; ++it) if(*it % 2 == 0) ++c; keep(c);},
+        [data, n]{std::size_t c = 0; for(auto it = data->begin(); it != data->end() && c < n / 2; ++it) if(*it % 2 == 0) {++c; keep(*it);} },
+        [data]{std::size_t c = 0; for(auto it = data->begin(); it != data->end(); ++it) if(*it % 2 == 0) ++c; keep(c);});
+
+    // ZipIt
+    addOperations(list, "zip", n,
+        [data]{return lazy::zip(data->begin(), data->end(), data->begin(), data->end(), [](int x, int y){return x + y;});},
+        [data, n]{auto a = data->begin(); auto b = data->begin(); for(std::size_t i = 0; i < n; ++i) {++a; ++b; keep(a); keep(b);} },
+        [data, n]{auto a = data->begin(); auto b = data->begin(); for(std::size_t i = 0; i < n; ++i, ++a, ++b) keep(*a + *b);},
+        [data]{std::size_t c = 0; for(auto a = data->begin(), b = data->begin(); a != data->end() && b != data->end(); ++a, ++b) {++c; keep(c);} });
+
+    // unique - only 1000 distinct values
+    list.push_back({"unique/full", n,
+                    [data]{auto u = lazy::unique(data->begin(), data->end()); std::size_t c = 0; for(auto it = u.begin(); it != u.end(); ++it) {keep(*it); ++c;} keep(c);},
+                    [data]{std::unordered_set<int> seen; std::size_t c = 0; for(int x : *data) if(seen.insert(x).second) {keep(x); ++c;} keep(c);}});
+
+    // unique - all values distinct, set nodes drawn from arena which is freed at once
+    const std::size_t distinctCount = 100 * 1000;
+    auto distinct = std::make_shared<std::vector<int>>(distinctCount);
+    std::iota(distinct->begin(), distinct->end(), 0);
+    list.push_back({"unique/distinct_arena", distinctCount,
+                    [distinct]{
+                        lazy::MonotonicArena arena(1 << 20);
+                        auto u = lazy::unique(distinct->begin(), distinct->end(), lazy::MemoryBudget(), lazy::NoStats(), lazy::ArenaAllocator<int>(arena));
+                        std::size_t c = 0;
+                        for(auto it = u.begin(), end = u.end(); it != end; ++it) {keep(*it); ++c;}
+                        keep(c);
+                    },
+                    [distinct]{std::unordered_set<int> seen; std::size_t c = 0; for(int x : *distinct) if(seen.insert(x).second) {keep(x); ++c;} keep(c);}});
+
+    // any_range - erased map, element by element (indirect call per ++, * and ==) and in batches
+    auto erased = std::make_shared<lazy::any_range<int>>(lazy::map(data->begin(), data->end(), [](int x){return x * 3 + 1;}));
+    list.push_back({"any_range/walk", n,
+                    [erased]{std::size_t c = 0; for(auto it = erased->begin(), end = erased->end(); it != end; ++it) c += *it; keep(c);},
+                    [data]{std::size_t c = 0; for(int x : *data) c += x * 3 + 1; keep(c);}});
+    list.push_back({"any_range/for_each", n,
+                    [erased]{std::size_t c = 0; erased->for_each([&c](int x){c += x;}); keep(c);},
+                    [data]{std::size_t c = 0; for(int x : *data) c += x * 3 + 1; keep(c);}});
+
+    // Pipelines from complexTests.cpp
+    const std::size_t wordCount = 200 * 1000;
+    auto words = std::make_shared<std::vector<std::string>>(makeWords(wordCount));
+
+    list.push_back({"pipeline/chain1_filter_map_unique", wordCount,
+        [words]{
+            auto f = lazy::filter(words->begin(), words->end(), [](const std::string& w){return w.size() == 5;});
+            auto m = lazy::map(f.begin(), f.end(), [](const std::string& w){return w.size();});
+            auto u = lazy::unique(m.begin(), m.end());
+            std::size_t c = 0;
+            for(auto it = u.begin(); it != u.end(); ++it) ++c;
+            keep(c);
+        },
+        [words]{
+            std::unordered_set<std::size_t> seen;
+            std::size_t c = 0;
+            for(const auto& w : *words)
+                if(w.size() == 5 && seen.insert(w.size()).second) ++c;
+            keep(c);
+        }});
+
+    list.push_back({"pipeline/chain2_map_unique_zip", wordCount,
+        [words]{
+            auto m = lazy::map(words->begin(), words->end(), [](const std::string& w){return w.size();});
+            auto u = lazy::unique(m.begin(), m.end());
+            auto z = lazy::zip(u.begin(), u.end(), words->begin(), words->end(),
+                               [](std::size_t s, const std::string& w){return s != w.size() ? std::string("--") : w;});
+            std::size_t c = 0;
+            for(auto it = z.begin(); it != z.end(); ++it) c += it->size();
+            keep(c);
+        },
+        [words]{
+            std::unordered_set<std::size_t> seen;
+            std::vector<std::size_t> distinct;
+            for(const auto& w : *words)
+                if(seen.insert(w.size()).second) distinct.push_back(w.size());
+            std::size_t c = 0;
+            for(std::size_t i = 0; i < distinct.size() && i < words->size(); ++i)
+                c += (distinct[i] != (*words)[i].size() ? std::string("--") : (*words)[i]).size();
+            keep(c);
+        }});
+
+    list.push_back({"pipeline/chain3_map_zip_filter", wordCount,
+        [words]{
+            auto m = lazy::map(words->begin(), words->end(), [](const std::string& w){return w.size();});
+            auto z = lazy::zip(m.begin(), m.end(), words->begin(), words->end(),
+                               [](std::size_t s, const std::string& w){return w + " " + std::to_string(s);});
+            auto f = lazy::filter(z.begin(), z.end(), [](const std::string& s){return s.size() == 5;});
+            std::size_t c = 0;
+            for(auto it = f.begin(); it != f.end(); ++it) ++c;
+            keep(c);
+        },
+        [words]{
+            std::size_t c = 0;
+            for(const auto& w : *words)
+                if((w + " " + std::to_string(w.size())).size() == 5) ++c;
+            keep(c);
+        }});
+
+    // Scaling of unique over SequenceGenerator (test from studentExtraTests.cpp)
+    for(std::size_t scale = 1000; scale <= maxScale; scale *= 10)
+    {
+        int stop = static_cast<int>(scale);
+        list.push_back({"unique_sequence/" + std::to_string(scale), scale,
+            [stop]{
+                SequenceGenerator sg(stop);
+                auto u = lazy::unique(sg.begin(), sg.end());
+                int best = 0;
+                for(auto it = u.begin(); it != u.end(); ++it) best = std::max(best, *it);
+                keep(best);
+            },
+            [stop]{
+                SequenceGenerator sg(stop);
+                std::unordered_set<int> seen;
+                int best = 0;
+                for(auto it = sg.begin(); it != sg.end(); ++it)
+                    if(seen.insert(*it).second) best = std::max(best, *it);
+                keep(best);
+            }});
+    }
+
+    return list;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    std::size_t maxScale = 10 * 1000 * 1000;
+    std::string filter, baselinePath;
+    int warmup = 2, samples = 11;
+    double threshold = 0.25;
+    bool absolute = false;
+    for(int i = 1; i < argc; ++i)
+    {
+        bool hasValue = i + 1 < argc;
+        if(std::strcmp(argv[i], "--max-scale") == 0 && hasValue)
+            maxScale = static_cast<std::size_t>(std::strtod(argv[++i], nullptr));
+        else if(std::strcmp(argv[i], "--filter") == 0 && hasValue)
+            filter = argv[++i];
+        else if(std::strcmp(argv[i], "--warmup") == 0 && hasValue)
+            warmup = std::atoi(argv[++i]);
+        else if(std::strcmp(argv[i], "--samples") == 0 && hasValue)
+            samples = std::max(1, std::atoi(argv[++i]));
+        else if(std::strcmp(argv[i], "--baseline") == 0 && hasValue)
+            baselinePath = argv[++i];
+        else if(std::strcmp(argv[i], "--threshold") == 0 && hasValue)
+            threshold = std::strtod(argv[++i], nullptr);
+        else if(std::strcmp(argv[i], "--absolute") == 0)
+            absolute = true;
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--max-scale N] [--filter substring] [--warmup N] [--samples N]"
+                      << " [--baseline file.json [--threshold fraction] [--absolute]]" << std::endl;
+            return 2;
+        }
+    }
+
+    std::map<std::string, bench::Result> baseline;
+    if(!baselinePath.empty())
+    {
+        std::ifstream in(baselinePath);
+        if(!in)
+        {
+            std::cerr << "cannot read baseline " << baselinePath << std::endl;
+            return 2;
+        }
+        baseline = bench::readBaseline(in);
+        if(samples < bench::gateSamples)
+        {
+            std::cerr << "comparing against baseline needs at least " << bench::gateSamples << " samples, using them" << std::endl;
+            samples = bench::gateSamples;
+        }
+    }
+
+    std::vector<bench::Result> results;
+    int regressions = 0;
+    for(const auto& b : bench::benchmarks(maxScale))
+    {
+        if(b.name.find(filter) == std::string::npos)
+            continue;
+        results.push_back(bench::run(b, warmup, samples));
+        const auto& r = results.back();
+        std::cerr << r.name << ": " << r.lazy.median << " ns (ratio " << r.ratio.median << ")";
+
+        auto base = baseline.find(r.name);
+        if(b.gated && base != baseline.end() && bench::regressed(r, base->second, threshold, absolute))
+        {
+            ++regressions;
+            std::cerr << " REGRESSION, baseline " << base->second.lazy.median << " ns (ratio " << base->second.ratio.median << ")";
+        }
+        std::cerr << std::endl;
+    }
+    bench::printJson(results, std::cout);
+
+    if(regressions)
+        std::cerr << regressions << " benchmark(s) regressed against " << baselinePath << std::endl;
+    return regressions ? 1 : 0;
+}
@@ -0,0 +1,79 @@
+#!/bin/bash
+#
+# HW01, lazy functional library - compile-time benchmark
+# Author: David Kuťák, 433409
+#
+# Generates translation units with map/filter/zip pipelines of growing depth, compiles each of them
+# and prints JSON with compile time and object size per depth
+#
+# Usage: ./compileBench.sh [depth...] > compile_output.txt
+# Environment: CXX (default g++), CXXFLAGS (default -std=c++14 -O2), REPEAT (default 3, best time is reported)
+
+set -e
+
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:--std=c++14 -O2}
+REPEAT=${REPEAT:-3}
+DEPTHS=${*:-1 2 4 8 12 16 24 32}
+ROOT=$(cd "$(dirname "$0")" && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# Stage i of pipeline is map, filter or zip with the source vector (in this order, repeating)
+generate()
+{
+    local depth=$1
+    echo '#include "lazy.h"'
+    echo '#include <vector>'
+    echo 'int run(const std::vector<int>& v)'
+    echo '{'
+    echo '    auto r0 = lazy::map(v.begin(), v.end(), [](int x){return x + 1;});'
+    for ((i = 1; i < depth; ++i)); do
+        p=$((i - 1))
+        case $((i % 3)) in
+            0) echo "    auto r$i = lazy::map(r$p.begin(), r$p.end(), [](int x){return x + $i;});" ;;
+            1) echo "    auto r$i = lazy::filter(r$p.begin(), r$p.end(), [](int x){return x % $((i + 1)) != 0;});" ;;
+            2) echo "    auto r$i = lazy::zip(r$p.begin(), r$p.end(), v.begin(), v.end(), [](int x, int y){return x - y;});" ;;
+        esac
+    done
+    last=$((depth - 1))
+    echo '    int sum = 0;'
+    echo "    for(auto it = r$last.begin(); it != r$last.end(); ++it)"
+    echo '        sum += *it;'
+    echo '    return sum;'
+    echo '}'
+}
+
+now()
+{
+    date +%s%N
+}
+
+echo '{'
+echo "  \"compiler\": \"$($CXX --version | head -1)\","
+echo "  \"flags\": \"$CXXFLAGS\","
+echo '  "pipelines": ['
+first=1
+for depth in $DEPTHS; do
+    src=$WORK/depth$depth.cpp
+    obj=$WORK/depth$depth.o
+    generate "$depth" > "$src"
+
+    best=
+    for ((r = 0; r < REPEAT; ++r)); do
+        start=$(now)
+        $CXX $CXXFLAGS -I"$ROOT" -c "$src" -o "$obj"
+        elapsed=$(( ($(now) - start) / 1000000 ))
+        if [ -z "$best" ] || [ "$elapsed" -lt "$best" ]; then
+            best=$elapsed
+        fi
+    done
+
+    [ $first = 1 ] || echo ','
+    first=0
+    printf '    {"depth": %d, "compile_ms": %d, "object_bytes": %d}' "$depth" "$best" "$(stat -c %s "$obj")"
+    echo "depth $depth: $best ms" >&2
+done
+echo
+echo '  ]'
+echo '}'
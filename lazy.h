@@ -5,488 +5,2524 @@
 #pragma once
 
 #include <type_traits>
+#include <cstddef>
 #include <iterator>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
 #include <functional>
+#include <limits>
 #include <utility>
 #include <memory>
+#include <new>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <tuple>
 #include <unordered_set>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
 
 namespace lazy
 {
 
 /**
- * Nested namespace containing additional helper classes/functions
+ * INSTRUMENTATION
+ * Statistics policy is the last template parameter of MapIt, FilterIt and ZipIt (and of unique)
  */
-namespace helper
+
+/**
+ * Counters of one pipeline stage, filled by Counting and Timing policies
+ * pulled - elements taken from underlying range, yielded - elements passed further
+ * (map and zip count element when its result is computed, elements stepped over unread are not counted),
+ * calls - invocations of function/predicate, cacheHits - dereferences answered by cached result,
+ * setSize & probes - size of the set of unique and elements compared during its lookups,
+ * ticks - time spent in function/predicate (TSC cycles on x86, nanoseconds elsewhere)
+ */
+struct StageStats
 {
+    std::size_t pulled = 0;
+    std::size_t yielded = 0;
+    std::size_t calls = 0;
+    std::size_t cacheHits = 0;
+    std::size_t setSize = 0;
+    std::size_t probes = 0;
+    std::uint64_t ticks = 0;
+};
 
 /**
- * UniqueFunc is functor passed to FilterIt to achieve unique functionality
+ * Default policy - all hooks are empty and iterators inherit the policy as empty base, so it compiles away
  */
-template<typename T>
-class UniqueFunc
+struct NoStats
 {
-private:
-    std::unordered_set<T> mFoundValues;
+    static constexpr bool enabled = false;
 
-    bool isUnique(T res)
-    {
-        auto tmp = mFoundValues.insert(res);
-        return tmp.second;
-    }
-public:
-    UniqueFunc():mFoundValues(std::unordered_set<T>()) {}
+    void onPull() {}
+    void onYield() {}
+    void onCacheHit() {}
+    void onUnique(std::size_t, std::size_t) {}
 
-    bool operator()(T val)
+    template<typename F>
+    decltype(auto) onCall(F&& f)
     {
-        return isUnique(val);
+        return f();
     }
 };
 
 /**
- * Functions used to deduce tag of custom iterator
+ * Counts events of stage into StageStats owned by caller (it has to outlive the range)
+ * All copies of iterators of the stage share the same counters
+ * Default constructed policy (e.g. of default constructed iterator) has no counters and counts nothing
  */
-constexpr bool isInputIterator(std::input_iterator_tag)
-{
-    return true;
-}
-
-template<typename T>
-constexpr bool isInputIterator(T)
+class Counting
 {
-    return false;
-}
+    protected:
+    StageStats* mStats;
 
-/**
- * If input iterator is passed, resulting type is std::input_iterator_tag, otherwise std::forward_iterator_tag
- */
-template<typename Iterator,
-         typename Result = typename std::conditional<isInputIterator(typename std::iterator_traits<Iterator>::iterator_category()),
-                                                     std::input_iterator_tag,
-                                                     std::forward_iterator_tag>::type
-         >
-constexpr Result getIteratorType()
-{
-    return Result();
-}
+    public:
+    static constexpr bool enabled = true;
 
-}
+    Counting()
+        :mStats(nullptr)
+    { }
 
-/**
- * ITERATORS
- */
+    explicit Counting(StageStats& stats)
+        :mStats(&stats)
+    { }
 
-/**
- * Range struct contains and provides begin & end iterators of given object
- */
-template<typename Iter>
-struct Range
-{
-private:
-    Iter mBeg;
-    Iter mEnd;
-public:
-    typedef typename std::iterator_traits<Iter>::value_type value_type;
-    typedef typename std::iterator_traits<Iter>::reference reference;
-    typedef typename std::iterator_traits<Iter>::pointer pointer;
+    void onPull()
+    {
+        if(mStats)
+            ++mStats->pulled;
+    }
 
-    Range(Iter beg, Iter end)
-        :mBeg(beg), mEnd(end) {}
+    void onYield()
+    {
+        if(mStats)
+            ++mStats->yielded;
+    }
 
-    Range(const Range<Iter>& other) = default;
+    void onCacheHit()
+    {
+        if(mStats)
+            ++mStats->cacheHits;
+    }
 
-    Iter begin() const
+    void onUnique(std::size_t setSize, std::size_t probes)
     {
-        return mBeg;
+        if(!mStats)
+            return;
+        mStats->setSize = setSize;
+        mStats->probes += probes;
     }
 
-    Iter end() const
+    template<typename F>
+    decltype(auto) onCall(F&& f)
     {
-        return mEnd;
+        if(mStats)
+            ++mStats->calls;
+        return f();
     }
 };
 
 /**
- * MapIt is iterator designed for (lazy) map function
- * Operates with underlying operator, applies (on demand) unary function to default values and returns new result
- * Iterator tag is equal to type returned by helper::getIteratorType function
+ * Counting which also measures time spent in function/predicate of the stage
  */
-template<typename Iter, typename Result>
-class MapIt : public std::iterator<decltype(helper::getIteratorType<Iter>()), Result>
+class Timing : public Counting
 {
     private:
-    using valType = typename std::iterator_traits<Iter>::value_type;
-    using tUnFunc = std::function<Result(const valType&)>;
-
-    std::unique_ptr<Iter> mDataIterator;
-    std::unique_ptr<Result> mLastResult;
-    bool mIsResultActual;
-    tUnFunc mUnaryFunction;
-
-    void makeStep()
-    {
-        ++*mDataIterator;
-        mIsResultActual = false;
-    }
-
-    void swap(MapIt& other)
+    class Timer
     {
-        using std::swap;
-        swap(mDataIterator, other.mDataIterator);
-        swap(mLastResult, other.mLastResult);
-        swap(mIsResultActual, other.mIsResultActual);
-        swap(mUnaryFunction, other.mUnaryFunction);
-    }
+        private:
+        StageStats& mStats;
+        std::uint64_t mStart;
 
-    public:
-    MapIt()
-        : mDataIterator(nullptr), mLastResult(nullptr), mIsResultActual(false), mUnaryFunction(tUnFunc())
-    { }
+        public:
+        explicit Timer(StageStats& stats)
+            :mStats(stats), mStart(now())
+        { }
 
-    MapIt(Iter dataIterator, tUnFunc unaryFunction)
-        : mDataIterator(std::make_unique<Iter>(dataIterator)), mLastResult(nullptr), mIsResultActual(false), mUnaryFunction(unaryFunction)
-    { }
+        ~Timer()
+        {
+            mStats.ticks += now() - mStart;
+        }
+    };
 
-    MapIt(const MapIt& other)
-        :mDataIterator(other.mDataIterator ? std::make_unique<Iter>(*other.mDataIterator) : nullptr),
-          mLastResult(other.mLastResult ? std::make_unique<Result>(*other.mLastResult) : nullptr),
-          mIsResultActual(other.mIsResultActual), mUnaryFunction(other.mUnaryFunction)
-    { }
+    public:
+    using Counting::Counting;
 
-    MapIt& operator=(MapIt other)
+    static std::uint64_t now()
     {
-        swap(other);
-        return *this;
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
     }
 
-    MapIt& operator++()
+    template<typename F>
+    decltype(auto) onCall(F&& f)
     {
-        makeStep();
-        return *this;
+        if(!mStats)
+            return f();
+        ++mStats->calls;
+        Timer timer(*mStats);
+        return f();
     }
+};
 
-    MapIt operator++(int)
-    {
-        auto tmp = *this;
-        makeStep();
-        return tmp;
-    }
+/**
+ * MEMORY
+ */
 
-    const Result& operator*()
+/**
+ * Limit of bytes held by state of a stage (seen-set of unique, buffer of cache, window of tee)
+ * Element takes sizeof plus its heap payload reported by helper::HeapBytes (strings and vectors,
+ * specialize it for own types owning heap memory)
+ * Throw - stage throws MemoryBudgetExceeded when the limit would be exceeded
+ * PassThrough - stage stops growing its state and degrades (unique passes values not found in its set,
+ * so values first seen after the limit was reached may repeat); cache and tee cannot drop elements,
+ * they throw with either action
+ */
+struct MemoryBudget
+{
+    enum Action
     {
-        if(mIsResultActual)
-            return *mLastResult;
+        Throw,
+        PassThrough
+    };
 
-        auto origData = *(*mDataIterator);
-        if(!mLastResult)
-            mLastResult = std::make_unique<Result>(mUnaryFunction(origData));
-        else
-            *mLastResult = mUnaryFunction(origData);
-        mIsResultActual = true;
-        return *mLastResult;
-    }
+    std::size_t bytes;
+    Action action;
 
-    const Result* operator->()
+    explicit MemoryBudget(std::size_t limit = std::numeric_limits<std::size_t>::max(), Action onExceed = Throw)
+        :bytes(limit), action(onExceed)
+    { }
+
+    bool isLimited() const
     {
-        return &(operator*());
+        return bytes != std::numeric_limits<std::size_t>::max();
     }
-
-    ~MapIt() = default;
-
-    template<typename I, typename R>
-    friend bool operator==(const MapIt<I, R>&, const MapIt<I, R>&);
-
-    template<typename I, typename R>
-    friend bool operator!=(const MapIt<I, R>&, const MapIt<I, R>&);
 };
 
-template<typename I, typename R>
-bool operator==(const MapIt<I, R>& lhs, const MapIt<I, R>& rhs)
-{
-    return lhs.mDataIterator && rhs.mDataIterator ? *lhs.mDataIterator == *rhs.mDataIterator : lhs.mDataIterator == rhs.mDataIterator;
-}
-
-template<typename I, typename R>
-bool operator!=(const MapIt<I, R>& lhs,const MapIt<I, R>& rhs)
+class MemoryBudgetExceeded : public std::length_error
 {
-    return !(lhs == rhs);
-}
+    public:
+    explicit MemoryBudgetExceeded(const std::string& stage)
+        :std::length_error(stage + ": memory budget exceeded")
+    { }
+};
 
 /**
- * FilterIt is iterator for filter function
- * Contains two underlying operators which determine the range of container => new "container" contains only values which are evaluated by predicate as true
- * Iterator tag is equal to type returned by helper::getIteratorType function
+ * MonotonicArena hands out memory from big chunks and never reuses it, all chunks are freed at once
+ * by release() or by the destructor, so stages allocating one node per element do not contend on malloc
+ * Chunks grow geometrically up to 64 MiB, with hugePages they are mapped anonymously, aligned to 2 MiB
+ * and advised to be backed by transparent huge pages (Linux only, elsewhere the flag is ignored)
+ * Arena is not thread safe and has to outlive everything allocated from it
  */
-template<typename Iter>
-class FilterIt : public std::iterator<decltype(helper::getIteratorType<Iter>()), typename std::iterator_traits<Iter>::value_type>
+class MonotonicArena
 {
     private:
-    using Result = typename std::iterator_traits<Iter>::value_type;
-    using tUnFunc = std::function<bool(const Result&)>;
-
-    std::unique_ptr<Iter> mDataIterator_beg;
-    std::unique_ptr<Iter> mDataIterator_end;
-    tUnFunc mUnaryPredicate;
-
-    void moveToFirst()
+    // Header at the start of each chunk, chunks form a list from the newest one
+    struct Chunk
     {
-        if(*mDataIterator_beg == *mDataIterator_end) return;
-
-        if(!mUnaryPredicate(*(*mDataIterator_beg)))
-            makeStep();
-    }
-
-    void makeStep()
+        Chunk* previous;
+        std::size_t bytes;
+        bool mapped;
+    };
+
+    static constexpr std::size_t maxChunk = std::size_t(64) << 20;
+    static constexpr std::size_t hugePage = std::size_t(2) << 20;
+
+    Chunk* mLast;
+    std::size_t mChunks;
+    std::size_t mReserved;
+    char* mCurrent;
+    std::size_t mRemaining;
+    std::size_t mNextChunk;
+    std::size_t mAllocated;
+    bool mHugePages;
+
+    void* mapHuge(std::size_t bytes)
     {
-        if(*mDataIterator_beg == *mDataIterator_end) return;
-
-        while(++*mDataIterator_beg != *mDataIterator_end &&
-              !mUnaryPredicate(*(*mDataIterator_beg)));
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        // Over-map by one huge page, so the chunk can start at huge page boundary
+        auto mapped = ::mmap(nullptr, bytes + hugePage, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(mapped == MAP_FAILED)
+            return nullptr;
+        auto start = reinterpret_cast<std::uintptr_t>(mapped);
+        auto aligned = (start + hugePage - 1) / hugePage * hugePage;
+        if(aligned != start)
+            ::munmap(mapped, aligned - start);
+        if(aligned + bytes != start + bytes + hugePage)
+            ::munmap(reinterpret_cast<void*>(aligned + bytes), start + hugePage - aligned);
+        ::madvise(reinterpret_cast<void*>(aligned), bytes, MADV_HUGEPAGE);
+        return reinterpret_cast<void*>(aligned);
+#else
+        (void)bytes;
+        return nullptr;
+#endif
     }
 
-    void swap(FilterIt& other)
+    void addChunk(std::size_t minBytes)
     {
-        using std::swap;
-        swap(mDataIterator_beg, other.mDataIterator_beg);
-        swap(mDataIterator_end, other.mDataIterator_end);
-        swap(mUnaryPredicate, other.mUnaryPredicate);
+        auto bytes = std::max(mNextChunk, minBytes + sizeof(Chunk));
+        if(mHugePages)
+            bytes = (bytes + hugePage - 1) / hugePage * hugePage;
+
+        auto memory = mHugePages ? mapHuge(bytes) : nullptr;
+        bool mapped = memory != nullptr;
+        if(!mapped)
+            memory = ::operator new(bytes);
+        mLast = new (memory) Chunk{mLast, bytes, mapped};
+        ++mChunks;
+        mReserved += bytes;
+
+        mCurrent = static_cast<char*>(memory) + sizeof(Chunk);
+        mRemaining = bytes - sizeof(Chunk);
+        mNextChunk = std::min(mNextChunk * 2, maxChunk);
     }
 
     public:
-    FilterIt()
-        :mDataIterator_beg(nullptr), mDataIterator_end(nullptr), mUnaryPredicate(tUnFunc())
+    explicit MonotonicArena(std::size_t initialChunk = 64 * 1024, bool hugePages = false)
+        :mLast(nullptr), mChunks(0), mReserved(0), mCurrent(nullptr), mRemaining(0), mNextChunk(std::max<std::size_t>(initialChunk, 64)), mAllocated(0), mHugePages(hugePages)
     { }
 
-    FilterIt(Iter dataIterator_beg, Iter dataIterator_end, tUnFunc unaryPredicate)
-        :mDataIterator_beg(std::make_unique<Iter>(dataIterator_beg)), mDataIterator_end(std::make_unique<Iter>(dataIterator_end)), mUnaryPredicate(unaryPredicate)
+    MonotonicArena(const MonotonicArena&) = delete;
+    MonotonicArena& operator=(const MonotonicArena&) = delete;
+
+    void* allocate(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t))
     {
-        // This stuff here is actually not "lazy", but it seems necessary to have it here
-        // to ensure the case when no element of given range will be present in resulting one
-        // so the resulting will be empty and without this begin & end iterators would not be equal although they should
-        moveToFirst();
+        bytes = std::max<std::size_t>(bytes, 1);
+        auto padding = (alignment - reinterpret_cast<std::uintptr_t>(mCurrent) % alignment) % alignment;
+        if(padding + bytes > mRemaining)
+        {
+            addChunk(bytes + alignment);
+            padding = (alignment - reinterpret_cast<std::uintptr_t>(mCurrent) % alignment) % alignment;
+        }
+        auto result = mCurrent + padding;
+        mCurrent += padding + bytes;
+        mRemaining -= padding + bytes;
+        mAllocated += bytes;
+        return result;
     }
 
-    FilterIt(const FilterIt& other)
-        :mDataIterator_beg(other.mDataIterator_beg ? std::make_unique<Iter>(*other.mDataIterator_beg) : nullptr),
-          mDataIterator_end(other.mDataIterator_end ? std::make_unique<Iter>(*other.mDataIterator_end) : nullptr),
-          mUnaryPredicate(other.mUnaryPredicate)
+    /**
+     * Memory is returned only by release()
+     */
+    void deallocate(void*, std::size_t)
     { }
 
-    FilterIt& operator=(FilterIt other)
+    /**
+     * Frees all chunks, everything allocated from the arena becomes invalid
+     */
+    void release()
     {
-        swap(other);
-        return *this;
+        while(mLast)
+        {
+            auto chunk = mLast;
+            mLast = chunk->previous;
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+            if(chunk->mapped)
+            {
+                ::munmap(chunk, chunk->bytes);
+                continue;
+            }
+#endif
+            ::operator delete(chunk);
+        }
+        mChunks = 0;
+        mReserved = 0;
+        mCurrent = nullptr;
+        mRemaining = 0;
+        mAllocated = 0;
     }
 
-    FilterIt& operator++()
+    /**
+     * Bytes handed out (without alignment padding)
+     */
+    std::size_t allocated() const
     {
-        makeStep();
-        return *this;
+        return mAllocated;
     }
 
-    FilterIt operator++(int)
+    /**
+     * Bytes of all chunks
+     */
+    std::size_t reserved() const
     {
-        auto tmp = *this;
-        makeStep();
-        return tmp;
+        return mReserved;
     }
 
-    const Result& operator*()
+    std::size_t chunks() const
     {
-        return *(*mDataIterator_beg);
+        return mChunks;
     }
 
-    const Result* operator->()
+    ~MonotonicArena()
     {
-        return &(operator*());
+        release();
     }
+};
 
-    ~FilterIt() = default;
+/**
+ * Standard allocator drawing from MonotonicArena, it only refers to the arena (copies are cheap)
+ * e.g. lazy::unique(first, last, lazy::MemoryBudget(), lazy::NoStats(), lazy::ArenaAllocator<int>(arena))
+ */
+template<typename T>
+class ArenaAllocator
+{
+    private:
+    MonotonicArena* mArena;
 
-    template<typename I>
-    friend bool operator==(const FilterIt<I>&, const FilterIt<I>&);
+    public:
+    using value_type = T;
 
-    template<typename I>
-    friend bool operator!=(const FilterIt<I>&, const FilterIt<I>&);
+    explicit ArenaAllocator(MonotonicArena& arena)
+        :mArena(&arena)
+    { }
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other)
+        :mArena(&other.arena())
+    { }
+
+    T* allocate(std::size_t n)
+    {
+        if(n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+            throw std::bad_array_new_length();
+        return static_cast<T*>(mArena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, std::size_t)
+    { }
+
+    MonotonicArena& arena() const
+    {
+        return *mArena;
+    }
 };
 
-template<typename I>
-bool operator==(const FilterIt<I>& lhs, const FilterIt<I>& rhs)
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
 {
-    return lhs.mDataIterator_beg && rhs.mDataIterator_beg ? *lhs.mDataIterator_beg == *rhs.mDataIterator_beg : lhs.mDataIterator_beg == rhs.mDataIterator_beg;
+    return &a.arena() == &b.arena();
 }
 
-template<typename I>
-bool operator!=(const FilterIt<I>& lhs, const FilterIt<I>& rhs)
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
 {
-    return !(lhs == rhs);
+    return !(a == b);
 }
 
 /**
- * ZipIt is iterator for zip functions
- * Contains two iterators, each one from (not necessarily) different container and applies binary function to each pair from those containers (on demand)
- * Iterator tag is equal to "weaker" type of two iterators:
- * if helper::getIteratorType function returns std::input_iterator_tag for one of iterators, resulting tag is also std::input_iterator_tag, otherwise std::forward_iterator_tag
+ * Nested namespace containing additional helper classes/functions
  */
-template<typename Iter1, typename Iter2, typename Result>
-class ZipIt : public std::iterator<typename std::conditional<helper::isInputIterator(helper::getIteratorType<Iter1>()),
-                                                             decltype(helper::getIteratorType<Iter1>()),
-                                                             decltype(helper::getIteratorType<Iter2>())>::type,
-                                   Result>
+namespace helper
 {
-    private:
-    template<typename I>
-    using valType = typename std::iterator_traits<I>::value_type;
-    using tBinFunc = std::function<Result(const valType<Iter1>&,
-    const valType<Iter2>&)>;
 
-    std::unique_ptr<Iter1> mDataIterator1;
-    std::unique_ptr<Iter2> mDataIterator2;
-    tBinFunc mBinaryFunction;
-    std::unique_ptr<Result> mLastResult;
-    bool mIsResultActual;
+/**
+ * Heap bytes owned by an element (not counting sizeof), used by memory budgets and memory_usage()
+ * Specialize for own types owning heap memory, by default elements own none
+ */
+template<typename T>
+struct HeapBytes
+{
+    static std::size_t of(const T&)
+    {
+        return 0;
+    }
+};
 
-    void makeStep()
+template<typename C, typename Traits, typename A>
+struct HeapBytes< std::basic_string<C, Traits, A> >
+{
+    // Short strings are stored inside the object
+    static std::size_t of(const std::basic_string<C, Traits, A>& str)
     {
-        ++*mDataIterator1;
-        ++*mDataIterator2;
-        mIsResultActual = false;
+        auto data = reinterpret_cast<const char*>(str.data());
+        auto self = reinterpret_cast<const char*>(&str);
+        if(data >= self && data < self + sizeof(str))
+            return 0;
+        return (str.capacity() + 1) * sizeof(C);
     }
+};
 
-    void swap(ZipIt& other)
+template<typename T, typename A>
+struct HeapBytes< std::vector<T, A> >
+{
+    static std::size_t of(const std::vector<T, A>& vec)
     {
-        using std::swap;
-        swap(mDataIterator1, other.mDataIterator1);
-        swap(mDataIterator2, other.mDataIterator2);
-        swap(mBinaryFunction, other.mBinaryFunction);
-        swap(mLastResult, other.mLastResult);
-        swap(mIsResultActual, other.mIsResultActual);
+        return vec.capacity() * sizeof(T);
     }
+};
 
-    public:
-    ZipIt()
-        :mDataIterator1(nullptr), mDataIterator2(nullptr), mBinaryFunction(tBinFunc()), mLastResult(nullptr), mIsResultActual(false)
-    {}
+template<typename T>
+std::size_t heapBytes(const T& value)
+{
+    return HeapBytes<T>::of(value);
+}
+
+/**
+ * Bucket count of unordered_set after extraElements more are inserted
+ * Grown array is estimated from the usual policy (at least doubled, rounded up to a prime), with 1/8 slack
+ * for the rounding, so the estimate is not below the real count
+ */
+template<typename Set>
+std::size_t bucketsAfterInsert(const Set& set, std::size_t extraElements)
+{
+    auto buckets = set.bucket_count();
+    auto needed = static_cast<std::size_t>(std::ceil((set.size() + extraElements) / set.max_load_factor()));
+    if(needed <= buckets)
+        return buckets;
+    auto grown = std::max(2 * buckets, needed);
+    return grown + grown / 8 + 1;
+}
+
+/**
+ * Estimated bytes of nodes and bucket array of unordered_set, with extraElements the bytes it will have
+ * after they are inserted (including rehash the insert triggers)
+ */
+template<typename Set>
+std::size_t setBytes(const Set& set, std::size_t extraElements = 0)
+{
+    constexpr std::size_t nodeBytes = sizeof(void*) + sizeof(typename Set::value_type) + sizeof(std::size_t);
+    return bucketsAfterInsert(set, extraElements) * sizeof(void*) + (set.size() + extraElements) * nodeBytes;
+}
+
+/**
+ * Allocators whose deallocate does nothing, memory is returned all at once by owner of the arena
+ * Specialize for own allocators to let stages skip their teardown
+ */
+template<typename Allocator>
+struct isMonotonic : std::false_type {};
+
+template<typename T>
+struct isMonotonic< ArenaAllocator<T> > : std::true_type {};
+
+/**
+ * Holds state of a stage, the destructor of the state is skipped when it would only return memory
+ * to monotonic allocator and destroy trivially destructible elements - it is O(1) instead of walk of all nodes
+ */
+template<typename State, bool skipDestructor>
+class StateHolder
+{
+    private:
+    State mState;
+
+    public:
+    explicit StateHolder(State state)
+        :mState(std::move(state))
+    { }
+
+    State& get()
+    {
+        return mState;
+    }
+
+    const State& get() const
+    {
+        return mState;
+    }
+};
+
+template<typename State>
+class StateHolder<State, true>
+{
+    private:
+    union
+    {
+        State mState;
+    };
+
+    public:
+    explicit StateHolder(State state)
+        :mState(std::move(state))
+    { }
+
+    StateHolder(const StateHolder& other)
+        :mState(other.mState)
+    { }
+
+    StateHolder(StateHolder&& other)
+        :mState(std::move(other.mState))
+    { }
+
+    StateHolder& operator=(const StateHolder&) = delete;
+
+    State& get()
+    {
+        return mState;
+    }
+
+    const State& get() const
+    {
+        return mState;
+    }
+
+    ~StateHolder()
+    { }
+};
+
+/**
+ * UniqueFunc is functor passed to FilterIt to achieve unique functionality
+ * Enabled statistics policy gets size of the set and length of bucket searched by each lookup
+ * With limited budget each new value is checked against it before being inserted
+ * Nodes and buckets of the set are allocated by Allocator (rebound to T), with ArenaAllocator
+ * the set of trivially destructible values is not torn down, the arena frees it
+ * Arena never reuses memory, so with monotonic Allocator the set is allocated in it once and shared by all copies
+ * of the functor (copies of iterator, e.g. the one returned by postfix ++), otherwise each copy has its own set
+ */
+template<typename T, typename Stats = NoStats, typename Allocator = std::allocator<T>>
+class UniqueFunc : private Stats
+{
+public:
+    using Set = std::unordered_set<T, std::hash<T>, std::equal_to<T>, typename std::allocator_traits<Allocator>::template rebind_alloc<T>>;
+    using Holder = StateHolder<Set, isMonotonic<Allocator>::value && std::is_trivially_destructible<T>::value>;
+
+private:
+    struct Seen
+    {
+        Holder values;
+        // Heap payload of values in the set (see HeapBytes)
+        std::size_t heapBytes;
+    };
+    using Storage = typename std::conditional<isMonotonic<Allocator>::value, std::shared_ptr<Seen>, Seen>::type;
+
+    Storage mSeen;
+    MemoryBudget mBudget;
+
+    static Storage makeSeen(Set set, const Allocator& alloc, std::true_type)
+    {
+        return std::allocate_shared<Seen>(alloc, Seen{Holder(std::move(set)), 0});
+    }
+
+    static Storage makeSeen(Set set, const Allocator&, std::false_type)
+    {
+        return Seen{Holder(std::move(set)), 0};
+    }
+
+    static Seen& access(Seen& seen)
+    {
+        return seen;
+    }
+
+    static const Seen& access(const Seen& seen)
+    {
+        return seen;
+    }
+
+    static Seen& access(const std::shared_ptr<Seen>& seen)
+    {
+        return *seen;
+    }
+
+    bool insert(const T& res)
+    {
+        auto& seen = access(mSeen);
+        auto inserted = seen.values.get().insert(res);
+        if(inserted.second)
+            seen.heapBytes += heapBytes(*inserted.first);
+        return inserted.second;
+    }
+
+    bool insertLimited(const T& res)
+    {
+        auto& seen = access(mSeen);
+        auto& set = seen.values.get();
+        if(set.count(res))
+            return false;
+        if(setBytes(set, 1) + seen.heapBytes + heapBytes(res) > mBudget.bytes)
+        {
+            if(mBudget.action == MemoryBudget::Throw)
+                throw MemoryBudgetExceeded("unique");
+            return true;
+        }
+        return insert(res);
+    }
+
+    bool isUnique(T res)
+    {
+        auto& set = access(mSeen).values.get();
+        std::size_t probes = 0;
+        if(Stats::enabled && set.bucket_count())
+            probes = set.bucket_size(set.bucket(res));
+        bool inserted = mBudget.isLimited() ? insertLimited(res) : insert(res);
+        this->onUnique(set.size(), probes);
+        return inserted;
+    }
+public:
+    UniqueFunc(Stats stats = Stats(), MemoryBudget budget = MemoryBudget(), Allocator alloc = Allocator())
+        :Stats(std::move(stats)), mSeen(makeSeen(Set(typename Set::allocator_type(alloc)), alloc, isMonotonic<Allocator>())), mBudget(budget) {}
+
+    std::size_t memory_usage() const
+    {
+        const auto& seen = access(mSeen);
+        return setBytes(seen.values.get()) + seen.heapBytes;
+    }
+
+    bool operator()(T val)
+    {
+        return isUnique(val);
+    }
+};
+
+/**
+ * Copies cached result of MapIt/ZipIt
+ * Move-only results are not copied at all, the copy recomputes its result on demand
+ */
+template<typename Result>
+std::unique_ptr<Result> cloneResult(const std::unique_ptr<Result>& result, std::true_type)
+{
+    return result ? std::make_unique<Result>(*result) : nullptr;
+}
+
+template<typename Result>
+std::unique_ptr<Result> cloneResult(const std::unique_ptr<Result>&, std::false_type)
+{
+    return nullptr;
+}
+
+template<typename Result>
+std::unique_ptr<Result> cloneResult(const std::unique_ptr<Result>& result)
+{
+    return cloneResult(result, std::is_copy_constructible<Result>());
+}
+
+/**
+ * Stores new value to the result cache
+ * Existing object is reused if Result is move assignable, otherwise it is replaced
+ */
+template<typename Result>
+void storeResult(std::unique_ptr<Result>& cache, Result&& value, std::true_type)
+{
+    *cache = std::move(value);
+}
+
+template<typename Result>
+void storeResult(std::unique_ptr<Result>& cache, Result&& value, std::false_type)
+{
+    cache = std::make_unique<Result>(std::move(value));
+}
+
+template<typename Result>
+void storeResult(std::unique_ptr<Result>& cache, Result&& value)
+{
+    if(!cache)
+        cache = std::make_unique<Result>(std::move(value));
+    else
+        storeResult(cache, std::move(value), std::is_move_assignable<Result>());
+}
+
+/**
+ * Deduces type of the output parameter of function f(const T&, R& out) passed to map_into
+ * Works for function pointers and functors with single (non-template) operator()
+ */
+template<typename F>
+struct outputArgType : outputArgType<decltype(&F::operator())> {};
+
+template<typename R, typename A1, typename A2>
+struct outputArgType<R(*)(A1, A2)>
+{
+    using type = typename std::decay<A2>::type;
+};
+
+template<typename C, typename R, typename A1, typename A2>
+struct outputArgType<R(C::*)(A1, A2)> : outputArgType<R(*)(A1, A2)> {};
+
+template<typename C, typename R, typename A1, typename A2>
+struct outputArgType<R(C::*)(A1, A2) const> : outputArgType<R(*)(A1, A2)> {};
+
+/**
+ * Result type of map_into - explicitly given one or the deduced one if void is given
+ */
+template<typename Result, typename F>
+struct mapIntoResult
+{
+    using type = Result;
+};
+
+template<typename F>
+struct mapIntoResult<void, F>
+{
+    using type = typename outputArgType<typename std::decay<F>::type>::type;
+};
+
+/**
+ * Functions used to deduce tag of custom iterator
+ */
+constexpr bool isInputIterator(std::input_iterator_tag)
+{
+    return true;
+}
+
+template<typename T>
+constexpr bool isInputIterator(T)
+{
+    return false;
+}
+
+/**
+ * If input iterator is passed, resulting type is std::input_iterator_tag, otherwise std::forward_iterator_tag
+ * Alias templates are used in iterator declarations, they are cheaper to instantiate than function templates in decltype
+ */
+template<typename Iterator>
+using iteratorTag = typename std::conditional<std::is_same<typename std::iterator_traits<Iterator>::iterator_category, std::input_iterator_tag>::value,
+                                              std::input_iterator_tag,
+                                              std::forward_iterator_tag>::type;
+
+template<typename Iterator, typename Result = iteratorTag<Iterator>>
+constexpr Result getIteratorType()
+{
+    return Result();
+}
+
+template<typename Iterator>
+using valueType = typename std::iterator_traits<Iterator>::value_type;
+
+/**
+ * Type returned by function F called with Args
+ */
+#if __cplusplus >= 201703L
+template<typename F, typename... Args>
+using invokeResult = typename std::invoke_result<F, Args...>::type;
+#else
+template<typename F, typename... Args>
+using invokeResult = typename std::result_of<F(Args...)>::type;
+#endif
+
+/**
+ * True if at least one of given values is true (used for parameter packs)
+ */
+constexpr bool anyOf()
+{
+    return false;
+}
+
+template<typename... Bools>
+constexpr bool anyOf(bool first, Bools... rest)
+{
+    return first || anyOf(rest...);
+}
+
+/**
+ * Tag of iterator combining several iterators - std::input_iterator_tag if any of them is input one
+ */
+template<typename... Iters>
+using weakestIteratorType = typename std::conditional<anyOf(std::is_same<iteratorTag<Iters>, std::input_iterator_tag>::value...),
+                                                      std::input_iterator_tag,
+                                                      std::forward_iterator_tag>::type;
+
+/**
+ * Type returned when dereferencing iterator which just passes elements of Iter through
+ * Constant reference for ordinary iterators, value for iterators returning temporaries (e.g. ZipTupleIt)
+ */
+template<typename Iter, typename Ref = decltype(*std::declval<Iter&>())>
+using passedReference = typename std::conditional<std::is_reference<Ref>::value,
+                                                  const typename std::remove_reference<Ref>::type&,
+                                                  Ref>::type;
+
+/**
+ * Checks if T provides begin() and end(), i.e. it can be passed to range based functions
+ */
+template<typename T, typename = void>
+struct isRange : std::false_type {};
+
+template<typename T>
+struct isRange<T, decltype(std::begin(std::declval<T&>()), std::end(std::declval<T&>()), void())> : std::true_type {};
+
+/**
+ * Checks if T is lazy::Range, i.e. cheap view which may be passed as temporary
+ */
+template<typename T>
+struct isRangeView : std::false_type {};
+
+/**
+ * Argument of range based function - lvalue range or any lazy::Range (temporary containers would dangle)
+ */
+template<typename T>
+struct isRangeArg : std::integral_constant<bool, isRange<typename std::remove_reference<T>::type>::value &&
+                                                 (std::is_lvalue_reference<T>::value || isRangeView<typename std::decay<T>::type>::value)> {};
+
+template<typename... Ts>
+constexpr bool allRanges()
+{
+    return !anyOf(!isRangeArg<Ts>::value...);
+}
+
+/**
+ * Calls f with elements of tuple t as arguments
+ */
+template<typename F, typename Tuple, std::size_t... I>
+decltype(auto) applyTuple(F& f, const Tuple& t, std::index_sequence<I...>)
+{
+    return f(std::get<I>(t)...);
+}
+
+template<typename F, typename Tuple>
+decltype(auto) applyTuple(F& f, const Tuple& t)
+{
+    return applyTuple(f, t, std::make_index_sequence<std::tuple_size<Tuple>::value>());
+}
+
+/**
+ * Bytes reported by memory_usage() of lazy iterators, 0 for other objects (plain iterators hold nothing)
+ */
+template<typename T>
+auto memoryUsage(const T& x, int) -> decltype(x.memory_usage())
+{
+    return x.memory_usage();
+}
+
+template<typename T>
+std::size_t memoryUsage(const T&, long)
+{
+    return 0;
+}
+
+template<typename T>
+std::size_t memoryUsage(const T& x)
+{
+    return memoryUsage(x, 0);
+}
+
+/**
+ * Bytes held by element storage of container (elements are counted by sizeof only)
+ */
+template<typename T, typename A>
+std::size_t containerBytes(const std::vector<T, A>& c)
+{
+    return c.capacity() * sizeof(T);
+}
+
+template<typename T, typename A>
+std::size_t containerBytes(const std::deque<T, A>& c)
+{
+    return c.size() * sizeof(T);
+}
+
+}
+
+/**
+ * ITERATORS
+ */
+
+/**
+ * Range struct contains and provides begin & end iterators of given object
+ */
+template<typename Iter>
+struct Range
+{
+private:
+    Iter mBeg;
+    Iter mEnd;
+public:
+    typedef typename std::iterator_traits<Iter>::value_type value_type;
+    typedef typename std::iterator_traits<Iter>::reference reference;
+    typedef typename std::iterator_traits<Iter>::pointer pointer;
+
+    Range(Iter beg, Iter end)
+        :mBeg(std::move(beg)), mEnd(std::move(end)) {}
+
+    Range(const Range<Iter>& other) = default;
+
+    Iter begin() const
+    {
+        return mBeg;
+    }
+
+    Iter end() const
+    {
+        return mEnd;
+    }
+
+    /**
+     * Bytes held by stages producing the range, measured through its begin iterator
+     */
+    std::size_t memory_usage() const
+    {
+        return sizeof(Range) + helper::memoryUsage(mBeg);
+    }
+};
+
+namespace helper
+{
+template<typename Iter>
+struct isRangeView< Range<Iter> > : std::true_type {};
+}
+
+/**
+ * MapIt is iterator designed for (lazy) map function
+ * Operates with underlying operator, applies (on demand) unary function to default values and returns new result
+ * Iterator tag is equal to helper::iteratorTag
+ * Stats is statistics policy (NoStats, Counting or Timing)
+ */
+template<typename Iter, typename Result, typename Stats = NoStats>
+class MapIt : public std::iterator<helper::iteratorTag<Iter>, Result>, private Stats
+{
+    private:
+    using valType = typename std::iterator_traits<Iter>::value_type;
+    using tUnFunc = std::function<Result(const valType&)>;
+
+    std::unique_ptr<Iter> mDataIterator;
+    std::unique_ptr<Result> mLastResult;
+    bool mIsResultActual;
+    tUnFunc mUnaryFunction;
+
+    void makeStep()
+    {
+        ++*mDataIterator;
+        mIsResultActual = false;
+    }
+
+    void swap(MapIt& other)
+    {
+        using std::swap;
+        swap(static_cast<Stats&>(*this), static_cast<Stats&>(other));
+        swap(mDataIterator, other.mDataIterator);
+        swap(mLastResult, other.mLastResult);
+        swap(mIsResultActual, other.mIsResultActual);
+        swap(mUnaryFunction, other.mUnaryFunction);
+    }
+
+    public:
+    MapIt()
+        : mDataIterator(nullptr), mLastResult(nullptr), mIsResultActual(false), mUnaryFunction(tUnFunc())
+    { }
+
+    MapIt(Iter dataIterator, tUnFunc unaryFunction, Stats stats = Stats())
+        : Stats(std::move(stats)), mDataIterator(std::make_unique<Iter>(std::move(dataIterator))), mLastResult(nullptr), mIsResultActual(false), mUnaryFunction(std::move(unaryFunction))
+    { }
+
+    MapIt(const MapIt& other)
+        :Stats(other), mDataIterator(other.mDataIterator ? std::make_unique<Iter>(*other.mDataIterator) : nullptr),
+          mLastResult(helper::cloneResult(other.mLastResult)),
+          mIsResultActual(mLastResult && other.mIsResultActual), mUnaryFunction(other.mUnaryFunction)
+    { }
+
+    MapIt(MapIt&& other) = default;
+
+    MapIt& operator=(MapIt other)
+    {
+        swap(other);
+        return *this;
+    }
+
+    MapIt& operator++()
+    {
+        makeStep();
+        return *this;
+    }
+
+    MapIt operator++(int)
+    {
+        // Cached result would be outdated after the step anyway, so it is handed over instead of copied
+        MapIt tmp(*mDataIterator, mUnaryFunction, *this);
+        std::swap(tmp.mLastResult, mLastResult);
+        tmp.mIsResultActual = mIsResultActual;
+        makeStep();
+        return tmp;
+    }
+
+    const Result& operator*()
+    {
+        if(mIsResultActual)
+        {
+            this->onCacheHit();
+            return *mLastResult;
+        }
+
+        // Element is produced (pulled and yielded) when it is computed, not when iterator steps over it
+        this->onPull();
+        const auto& origData = *(*mDataIterator);
+        helper::storeResult(mLastResult, this->onCall([&]{return mUnaryFunction(origData);}));
+        this->onYield();
+        mIsResultActual = true;
+        return *mLastResult;
+    }
+
+    /**
+     * Moves current result out of the iterator (usable for move-only results)
+     * Next dereference computes the result again
+     */
+    Result take()
+    {
+        operator*();
+        mIsResultActual = false;
+        return std::move(*mLastResult);
+    }
+
+    const Result* operator->()
+    {
+        return &(operator*());
+    }
+
+    /**
+     * Bytes held by the iterator (underlying iterator, cached result) and by stages it reads from
+     */
+    std::size_t memory_usage() const
+    {
+        return (mDataIterator ? sizeof(Iter) + helper::memoryUsage(*mDataIterator) : 0) + (mLastResult ? sizeof(Result) + helper::heapBytes(*mLastResult) : 0);
+    }
+
+    ~MapIt() = default;
+
+    template<typename I, typename R, typename S>
+    friend bool operator==(const MapIt<I, R, S>&, const MapIt<I, R, S>&);
+
+    template<typename I, typename R, typename S>
+    friend bool operator!=(const MapIt<I, R, S>&, const MapIt<I, R, S>&);
+};
+
+template<typename I, typename R, typename S>
+bool operator==(const MapIt<I, R, S>& lhs, const MapIt<I, R, S>& rhs)
+{
+    return lhs.mDataIterator && rhs.mDataIterator ? *lhs.mDataIterator == *rhs.mDataIterator : lhs.mDataIterator == rhs.mDataIterator;
+}
+
+template<typename I, typename R, typename S>
+bool operator!=(const MapIt<I, R, S>& lhs,const MapIt<I, R, S>& rhs)
+{
+    return !(lhs == rhs);
+}
+
+/**
+ * MapIntoIt is iterator for map_into function
+ * Works like MapIt, but function writes its result into the cached object instead of returning new one,
+ * so buffers (strings, vectors) owned by the result are reused between elements
+ * Result has to be default constructible
+ */
+template<typename Iter, typename Result>
+class MapIntoIt : public std::iterator<helper::iteratorTag<Iter>, Result>
+{
+    private:
+    using valType = typename std::iterator_traits<Iter>::value_type;
+    using tOutFunc = std::function<void(const valType&, Result&)>;
+
+    std::unique_ptr<Iter> mDataIterator;
+    std::unique_ptr<Result> mLastResult;
+    bool mIsResultActual;
+    tOutFunc mOutputFunction;
+
+    void makeStep()
+    {
+        ++*mDataIterator;
+        mIsResultActual = false;
+    }
+
+    void swap(MapIntoIt& other)
+    {
+        using std::swap;
+        swap(mDataIterator, other.mDataIterator);
+        swap(mLastResult, other.mLastResult);
+        swap(mIsResultActual, other.mIsResultActual);
+        swap(mOutputFunction, other.mOutputFunction);
+    }
+
+    public:
+    MapIntoIt()
+        : mDataIterator(nullptr), mLastResult(nullptr), mIsResultActual(false), mOutputFunction(tOutFunc())
+    { }
+
+    MapIntoIt(Iter dataIterator, tOutFunc outputFunction)
+        : mDataIterator(std::make_unique<Iter>(std::move(dataIterator))), mLastResult(nullptr), mIsResultActual(false), mOutputFunction(std::move(outputFunction))
+    { }
+
+    MapIntoIt(const MapIntoIt& other)
+        :mDataIterator(other.mDataIterator ? std::make_unique<Iter>(*other.mDataIterator) : nullptr),
+          mLastResult(helper::cloneResult(other.mLastResult)),
+          mIsResultActual(mLastResult && other.mIsResultActual), mOutputFunction(other.mOutputFunction)
+    { }
+
+    MapIntoIt(MapIntoIt&& other) = default;
+
+    MapIntoIt& operator=(MapIntoIt other)
+    {
+        swap(other);
+        return *this;
+    }
+
+    MapIntoIt& operator++()
+    {
+        makeStep();
+        return *this;
+    }
+
+    MapIntoIt operator++(int)
+    {
+        // Buffer stays with this iterator, the copy gets copy of computed result or computes its own on demand
+        auto tmp = *this;
+        makeStep();
+        return tmp;
+    }
+
+    const Result& operator*()
+    {
+        if(mIsResultActual)
+            return *mLastResult;
+
+        if(!mLastResult)
+            mLastResult = std::make_unique<Result>();
+        mOutputFunction(*(*mDataIterator), *mLastResult);
+        mIsResultActual = true;
+        return *mLastResult;
+    }
+
+    const Result* operator->()
+    {
+        return &(operator*());
+    }
+
+    /**
+     * Bytes held by the iterator (underlying iterator, cached result) and by stages it reads from
+     */
+    std::size_t memory_usage() const
+    {
+        return (mDataIterator ? sizeof(Iter) + helper::memoryUsage(*mDataIterator) : 0) + (mLastResult ? sizeof(Result) + helper::heapBytes(*mLastResult) : 0);
+    }
+
+    ~MapIntoIt() = default;
+
+    template<typename I, typename R>
+    friend bool operator==(const MapIntoIt<I, R>&, const MapIntoIt<I, R>&);
+
+    template<typename I, typename R>
+    friend bool operator!=(const MapIntoIt<I, R>&, const MapIntoIt<I, R>&);
+};
+
+template<typename I, typename R>
+bool operator==(const MapIntoIt<I, R>& lhs, const MapIntoIt<I, R>& rhs)
+{
+    return lhs.mDataIterator && rhs.mDataIterator ? *lhs.mDataIterator == *rhs.mDataIterator : lhs.mDataIterator == rhs.mDataIterator;
+}
+
+template<typename I, typename R>
+bool operator!=(const MapIntoIt<I, R>& lhs,const MapIntoIt<I, R>& rhs)
+{
+    return !(lhs == rhs);
+}
+
+/**
+ * FilterIt is iterator for filter function
+ * Contains two underlying operators which determine the range of container => new "container" contains only values which are evaluated by predicate as true
+ * Iterator tag is equal to helper::iteratorTag
+ * Stats is statistics policy (NoStats, Counting or Timing)
+ */
+template<typename Iter, typename Stats = NoStats>
+class FilterIt : public std::iterator<helper::iteratorTag<Iter>, helper::valueType<Iter>>, private Stats
+{
+    private:
+    using Result = typename std::iterator_traits<Iter>::value_type;
+    using tUnFunc = std::function<bool(const Result&)>;
+    using tMemFunc = std::size_t (*)(const tUnFunc&);
+
+    std::unique_ptr<Iter> mDataIterator_beg;
+    std::unique_ptr<Iter> mDataIterator_end;
+    tUnFunc mUnaryPredicate;
+    tMemFunc mPredicateMemory;
+
+    bool accepts()
+    {
+        this->onPull();
+        bool accepted = this->onCall([&]{return mUnaryPredicate(*(*mDataIterator_beg));});
+        if(accepted)
+            this->onYield();
+        return accepted;
+    }
+
+    void moveToFirst()
+    {
+        if(*mDataIterator_beg == *mDataIterator_end) return;
+
+        if(!accepts())
+            makeStep();
+    }
+
+    void makeStep()
+    {
+        if(*mDataIterator_beg == *mDataIterator_end) return;
+
+        while(++*mDataIterator_beg != *mDataIterator_end &&
+              !accepts());
+    }
+
+    void swap(FilterIt& other)
+    {
+        using std::swap;
+        swap(static_cast<Stats&>(*this), static_cast<Stats&>(other));
+        swap(mDataIterator_beg, other.mDataIterator_beg);
+        swap(mDataIterator_end, other.mDataIterator_end);
+        swap(mUnaryPredicate, other.mUnaryPredicate);
+        swap(mPredicateMemory, other.mPredicateMemory);
+    }
+
+    public:
+    FilterIt()
+        :mDataIterator_beg(nullptr), mDataIterator_end(nullptr), mUnaryPredicate(tUnFunc()), mPredicateMemory(nullptr)
+    { }
+
+    /**
+     * predicateMemory (if given) returns bytes held by the predicate, e.g. seen-set of unique
+     */
+    FilterIt(Iter dataIterator_beg, Iter dataIterator_end, tUnFunc unaryPredicate, Stats stats = Stats(), tMemFunc predicateMemory = nullptr)
+        :Stats(std::move(stats)), mDataIterator_beg(std::make_unique<Iter>(std::move(dataIterator_beg))), mDataIterator_end(std::make_unique<Iter>(std::move(dataIterator_end))),
+          mUnaryPredicate(std::move(unaryPredicate)), mPredicateMemory(predicateMemory)
+    {
+        // This stuff here is actually not "lazy", but it seems necessary to have it here
+        // to ensure the case when no element of given range will be present in resulting one
+        // so the resulting will be empty and without this begin & end iterators would not be equal although they should
+        moveToFirst();
+    }
+
+    FilterIt(const FilterIt& other)
+        :Stats(other), mDataIterator_beg(other.mDataIterator_beg ? std::make_unique<Iter>(*other.mDataIterator_beg) : nullptr),
+          mDataIterator_end(other.mDataIterator_end ? std::make_unique<Iter>(*other.mDataIterator_end) : nullptr),
+          mUnaryPredicate(other.mUnaryPredicate), mPredicateMemory(other.mPredicateMemory)
+    { }
+
+    FilterIt(FilterIt&& other) = default;
+
+    FilterIt& operator=(FilterIt other)
+    {
+        swap(other);
+        return *this;
+    }
+
+    FilterIt& operator++()
+    {
+        makeStep();
+        return *this;
+    }
+
+    FilterIt operator++(int)
+    {
+        auto tmp = *this;
+        makeStep();
+        return tmp;
+    }
+
+    helper::passedReference<Iter> operator*()
+    {
+        return *(*mDataIterator_beg);
+    }
+
+    const Result* operator->()
+    {
+        return &(operator*());
+    }
+
+    /**
+     * Bytes held by the iterator (underlying iterators, seen-set of unique) and by stages it reads from
+     */
+    std::size_t memory_usage() const
+    {
+        std::size_t bytes = 0;
+        if(mDataIterator_beg)
+            bytes += sizeof(Iter) + helper::memoryUsage(*mDataIterator_beg);
+        if(mDataIterator_end)
+            bytes += sizeof(Iter);
+        if(mPredicateMemory && mUnaryPredicate)
+            bytes += mPredicateMemory(mUnaryPredicate);
+        return bytes;
+    }
+
+    /**
+     * Position of current element in underlying range
+     */
+    const Iter& base() const
+    {
+        return *mDataIterator_beg;
+    }
+
+    ~FilterIt() = default;
+
+    template<typename I, typename S>
+    friend bool operator==(const FilterIt<I, S>&, const FilterIt<I, S>&);
+
+    template<typename I, typename S>
+    friend bool operator!=(const FilterIt<I, S>&, const FilterIt<I, S>&);
+};
+
+template<typename I, typename S>
+bool operator==(const FilterIt<I, S>& lhs, const FilterIt<I, S>& rhs)
+{
+    return lhs.mDataIterator_beg && rhs.mDataIterator_beg ? *lhs.mDataIterator_beg == *rhs.mDataIterator_beg : lhs.mDataIterator_beg == rhs.mDataIterator_beg;
+}
+
+template<typename I, typename S>
+bool operator!=(const FilterIt<I, S>& lhs, const FilterIt<I, S>& rhs)
+{
+    return !(lhs == rhs);
+}
+
+/**
+ * ZipIt is iterator for zip functions
+ * Contains two iterators, each one from (not necessarily) different container and applies binary function to each pair from those containers (on demand)
+ * Iterator tag is equal to "weaker" type of two iterators:
+ * if helper::iteratorTag is std::input_iterator_tag for one of iterators, resulting tag is also std::input_iterator_tag, otherwise std::forward_iterator_tag
+ * Stats is statistics policy (NoStats, Counting or Timing)
+ */
+template<typename Iter1, typename Iter2, typename Result, typename Stats = NoStats>
+class ZipIt : public std::iterator<helper::weakestIteratorType<Iter1, Iter2>, Result>, private Stats
+{
+    private:
+    template<typename I>
+    using valType = typename std::iterator_traits<I>::value_type;
+    using tBinFunc = std::function<Result(const valType<Iter1>&,
+    const valType<Iter2>&)>;
+
+    std::unique_ptr<Iter1> mDataIterator1;
+    std::unique_ptr<Iter2> mDataIterator2;
+    tBinFunc mBinaryFunction;
+    std::unique_ptr<Result> mLastResult;
+    bool mIsResultActual;
+
+    void makeStep()
+    {
+        ++*mDataIterator1;
+        ++*mDataIterator2;
+        mIsResultActual = false;
+    }
+
+    void swap(ZipIt& other)
+    {
+        using std::swap;
+        swap(static_cast<Stats&>(*this), static_cast<Stats&>(other));
+        swap(mDataIterator1, other.mDataIterator1);
+        swap(mDataIterator2, other.mDataIterator2);
+        swap(mBinaryFunction, other.mBinaryFunction);
+        swap(mLastResult, other.mLastResult);
+        swap(mIsResultActual, other.mIsResultActual);
+    }
+
+    public:
+    ZipIt()
+        :mDataIterator1(nullptr), mDataIterator2(nullptr), mBinaryFunction(tBinFunc()), mLastResult(nullptr), mIsResultActual(false)
+    {}
+
+    ZipIt(Iter1 dataIterator1, Iter2 dataIterator2, tBinFunc binaryFunction, Stats stats = Stats())
+        :Stats(std::move(stats)), mDataIterator1(std::make_unique<Iter1>(std::move(dataIterator1))), mDataIterator2(std::make_unique<Iter2>(std::move(dataIterator2))),
+          mBinaryFunction(std::move(binaryFunction)), mLastResult(nullptr), mIsResultActual(false)
+    { }
+
+    ZipIt(const ZipIt& other)
+        :Stats(other), mDataIterator1(other.mDataIterator1 ? std::make_unique<Iter1>(*other.mDataIterator1) : nullptr),
+          mDataIterator2(other.mDataIterator2 ? std::make_unique<Iter2>(*other.mDataIterator2) : nullptr),
+          mBinaryFunction(other.mBinaryFunction),
+          mLastResult(helper::cloneResult(other.mLastResult)),
+          mIsResultActual(mLastResult && other.mIsResultActual)
+    { }
+
+    ZipIt(ZipIt&& other) = default;
+
+    ZipIt& operator=(ZipIt other)
+    {
+        swap(other);
+        return *this;
+    }
+
+    ZipIt& operator++()
+    {
+        makeStep();
+        return *this;
+    }
+
+    ZipIt operator++(int)
+    {
+        // Cached result would be outdated after the step anyway, so it is handed over instead of copied
+        ZipIt tmp(*mDataIterator1, *mDataIterator2, mBinaryFunction, *this);
+        std::swap(tmp.mLastResult, mLastResult);
+        tmp.mIsResultActual = mIsResultActual;
+        makeStep();
+        return tmp;
+    }
+
+    const Result& operator*()
+    {
+        if(mIsResultActual)
+        {
+            this->onCacheHit();
+            return *mLastResult;
+        }
+
+        this->onPull();
+        const auto& origData1 = *(*mDataIterator1);
+        const auto& origData2 = *(*mDataIterator2);
+        helper::storeResult(mLastResult, this->onCall([&]{return mBinaryFunction(origData1, origData2);}));
+        this->onYield();
+        mIsResultActual = true;
+        return *mLastResult;
+    }
+
+    /**
+     * Moves current result out of the iterator (usable for move-only results)
+     * Next dereference computes the result again
+     */
+    Result take()
+    {
+        operator*();
+        mIsResultActual = false;
+        return std::move(*mLastResult);
+    }
+
+    const Result* operator->()
+    {
+        return &(operator*());
+    }
+
+    /**
+     * Bytes held by the iterator (underlying iterators, cached result) and by stages it reads from
+     */
+    std::size_t memory_usage() const
+    {
+        return (mDataIterator1 ? sizeof(Iter1) + helper::memoryUsage(*mDataIterator1) : 0) +
+               (mDataIterator2 ? sizeof(Iter2) + helper::memoryUsage(*mDataIterator2) : 0) +
+               (mLastResult ? sizeof(Result) + helper::heapBytes(*mLastResult) : 0);
+    }
+
+    ~ZipIt() = default;
+
+    template<typename I1, typename I2, typename R, typename S>
+    friend bool operator==(const ZipIt<I1, I2, R, S>&, const ZipIt<I1, I2, R, S>&);
+
+    template<typename I1, typename I2, typename R, typename S>
+    friend bool operator!=(const ZipIt<I1, I2, R, S>&, const ZipIt<I1, I2, R, S>&);
+};
+
+template<typename I1, typename I2, typename R, typename S>
+bool operator==(const ZipIt<I1, I2, R, S>& lhs, const ZipIt<I1, I2, R, S>& rhs)
+{
+    return (lhs.mDataIterator1 && rhs.mDataIterator1 ? *lhs.mDataIterator1 == *rhs.mDataIterator1 : lhs.mDataIterator1 == rhs.mDataIterator1) ||
+            (lhs.mDataIterator2 && rhs.mDataIterator2 ? *lhs.mDataIterator2 == *rhs.mDataIterator2 : lhs.mDataIterator2 == rhs.mDataIterator2);
+}
+
+template<typename I1, typename I2, typename R, typename S>
+bool operator!=(const ZipIt<I1, I2, R, S>& lhs, const ZipIt<I1, I2, R, S>& rhs)
+{
+    return !(lhs == rhs);
+}
+
+/**
+ * ProjectIt is iterator for project function
+ * Yields reference to one member of each element of underlying range (nothing is copied or cached)
+ * Iterator tag is equal to helper::iteratorTag
+ */
+template<typename Iter, typename Field>
+class ProjectIt : public std::iterator<helper::iteratorTag<Iter>, Field, std::ptrdiff_t, const Field*, const Field&>
+{
+    private:
+    using Record = typename std::iterator_traits<Iter>::value_type;
+
+    Iter mDataIterator;
+    Field Record::* mMember;
+
+    public:
+    ProjectIt()
+        :mDataIterator(), mMember(nullptr)
+    { }
+
+    ProjectIt(Iter dataIterator, Field Record::* member)
+        :mDataIterator(std::move(dataIterator)), mMember(member)
+    { }
+
+    ProjectIt& operator++()
+    {
+        ++mDataIterator;
+        return *this;
+    }
+
+    ProjectIt operator++(int)
+    {
+        auto tmp = *this;
+        ++mDataIterator;
+        return tmp;
+    }
+
+    const Field& operator*()
+    {
+        return (*mDataIterator).*mMember;
+    }
+
+    const Field* operator->()
+    {
+        return &(operator*());
+    }
+
+    bool operator==(const ProjectIt& other) const
+    {
+        return mDataIterator == other.mDataIterator;
+    }
+
+    bool operator!=(const ProjectIt& other) const
+    {
+        return !(*this == other);
+    }
+};
+
+/**
+ * SelectionIt is iterator for cache_selection function
+ * Wraps FilterIt (filter or unique) and records ordinal offsets of selected elements in the underlying range
+ * during the first pass, all iterators created from the same range share these offsets, so later passes
+ * neither evaluate predicate nor rehash values again
+ * Each iterator replays the selection by advancing its own copy of the underlying iterator from one recorded
+ * offset to the next (jump for random access iterators, walk without predicate for others)
+ * Only forward iterators are supported (positions of input iterators can not be revisited)
+ */
+template<typename FIter>
+class SelectionIt : public std::iterator<std::forward_iterator_tag, typename std::iterator_traits<FIter>::value_type>
+{
+    private:
+    using BaseIter = typename std::decay<decltype(std::declval<FIter&>().base())>::type;
+    using Result = typename std::iterator_traits<FIter>::value_type;
+    using BaseTag = typename std::iterator_traits<BaseIter>::iterator_category;
+
+    static_assert(!std::is_same<helper::iteratorTag<BaseIter>, std::input_iterator_tag>::value, "cache_selection needs forward iterators");
+
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    struct Selection
+    {
+        FIter live;
+        FIter end;
+        BaseIter origin;
+        BaseIter scan;
+        std::size_t scanOffset;
+        std::vector<std::size_t> offsets;
+        bool complete;
+    };
+
+    std::shared_ptr<Selection> mSelection;
+    std::size_t mIndex;
+    std::unique_ptr<BaseIter> mCursor;
+    std::size_t mCursorOffset;
+
+    /**
+     * Offset of position of the filter from the start of the selection
+     */
+    static std::size_t offsetOf(Selection& sel, const BaseIter& position, std::random_access_iterator_tag)
+    {
+        return static_cast<std::size_t>(position - sel.origin);
+    }
+
+    template<typename Tag>
+    static std::size_t offsetOf(Selection& sel, const BaseIter& position, Tag)
+    {
+        while(sel.scan != position)
+        {
+            ++sel.scan;
+            ++sel.scanOffset;
+        }
+        return sel.scanOffset;
+    }
+
+    /**
+     * Evaluates filter until offset with given index is recorded or the end is reached
+     */
+    bool isRecorded(std::size_t index) const
+    {
+        auto& sel = *mSelection;
+        while(sel.offsets.size() <= index && !sel.complete)
+        {
+            if(sel.live == sel.end)
+            {
+                sel.complete = true;
+                break;
+            }
+            sel.offsets.push_back(offsetOf(sel, sel.live.base(), BaseTag()));
+            ++sel.live;
+        }
+        return index < sel.offsets.size();
+    }
+
+    bool isAtEnd() const
+    {
+        return !mSelection || mIndex == npos || !isRecorded(mIndex);
+    }
+
+    public:
+    SelectionIt()
+        :mSelection(nullptr), mIndex(npos), mCursor(nullptr), mCursorOffset(0)
+    { }
+
+    SelectionIt(FIter first, FIter last)
+        :mIndex(0), mCursor(nullptr), mCursorOffset(0)
+    {
+        auto origin = first.base();
+        mSelection = std::make_shared<Selection>(Selection{std::move(first), std::move(last), origin, origin, 0,
+                                                           std::vector<std::size_t>(), false});
+    }
+
+    SelectionIt(const SelectionIt& other, std::size_t index)
+        :mSelection(other.mSelection), mIndex(index), mCursor(nullptr), mCursorOffset(0)
+    { }
+
+    SelectionIt(const SelectionIt& other)
+        :mSelection(other.mSelection), mIndex(other.mIndex),
+          mCursor(other.mCursor ? std::make_unique<BaseIter>(*other.mCursor) : nullptr), mCursorOffset(other.mCursorOffset)
+    { }
+
+    SelectionIt& operator=(SelectionIt other)
+    {
+        std::swap(mSelection, other.mSelection);
+        std::swap(mIndex, other.mIndex);
+        std::swap(mCursor, other.mCursor);
+        std::swap(mCursorOffset, other.mCursorOffset);
+        return *this;
+    }
+
+    SelectionIt& operator++()
+    {
+        ++mIndex;
+        return *this;
+    }
+
+    SelectionIt operator++(int)
+    {
+        auto tmp = *this;
+        ++mIndex;
+        return tmp;
+    }
+
+    /**
+     * Moves own underlying iterator to recorded offset, it is restarted from origin only when it is past it
+     */
+    helper::passedReference<BaseIter> operator*()
+    {
+        isRecorded(mIndex);
+        auto target = mSelection->offsets[mIndex];
+        if(!mCursor || mCursorOffset > target)
+        {
+            mCursor = std::make_unique<BaseIter>(mSelection->origin);
+            mCursorOffset = 0;
+        }
+        std::advance(*mCursor, static_cast<typename std::iterator_traits<BaseIter>::difference_type>(target - mCursorOffset));
+        mCursorOffset = target;
+        return **mCursor;
+    }
+
+    const Result* operator->()
+    {
+        return &(operator*());
+    }
+
+    /**
+     * Bytes held by shared state (recorded offsets), by own underlying iterator and by stages it reads from
+     */
+    std::size_t memory_usage() const
+    {
+        if(!mSelection)
+            return 0;
+        std::size_t bytes = sizeof(Selection) + helper::containerBytes(mSelection->offsets) + helper::memoryUsage(mSelection->live);
+        if(mCursor)
+            bytes += sizeof(BaseIter);
+        return bytes;
+    }
+
+    /**
+     * Number of selected elements known so far (all of them after the first full pass)
+     */
+    std::size_t recorded() const
+    {
+        return mSelection ? mSelection->offsets.size() : 0;
+    }
+
+    bool operator==(const SelectionIt& other) const
+    {
+        bool atEnd = isAtEnd();
+        bool otherAtEnd = other.isAtEnd();
+        if(atEnd || otherAtEnd)
+            return atEnd == otherAtEnd;
+        return mSelection == other.mSelection && mIndex == other.mIndex;
+    }
+
+    bool operator!=(const SelectionIt& other) const
+    {
+        return !(*this == other);
+    }
+};
+
+/**
+ * CacheIt is iterator for cache function
+ * Elements of underlying range are evaluated only once and stored to chunked buffer (std::deque),
+ * all iterators created from the same range share the buffer and replay elements from it,
+ * so even single-pass (input) ranges can be traversed many times
+ * Buffer is filled on demand, iterator tag is std::random_access_iterator_tag
+ * Buffer and its chunks are allocated by Allocator (e.g. ArenaAllocator)
+ */
+template<typename Iter, typename Allocator = std::allocator<typename std::iterator_traits<Iter>::value_type>>
+class CacheIt : public std::iterator<std::random_access_iterator_tag, typename std::iterator_traits<Iter>::value_type>
+{
+    private:
+    using Result = typename std::iterator_traits<Iter>::value_type;
+    using Values = std::deque<Result, typename std::allocator_traits<Allocator>::template rebind_alloc<Result>>;
+
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    struct Buffer
+    {
+        Iter live;
+        Iter end;
+        Values values;
+        bool complete;
+        MemoryBudget budget;
+        std::size_t heapBytes;
+    };
+
+    std::shared_ptr<Buffer> mBuffer;
+    std::size_t mIndex;
+
+    /**
+     * Evaluates underlying range until element with given index is buffered or the end is reached
+     * Element which would exceed the budget is not buffered and MemoryBudgetExceeded is thrown
+     */
+    bool isBuffered(std::size_t index) const
+    {
+        auto& buf = *mBuffer;
+        while(buf.values.size() <= index && !buf.complete)
+        {
+            if(buf.live == buf.end)
+            {
+                buf.complete = true;
+                break;
+            }
+            buf.values.push_back(*buf.live);
+            auto bytes = helper::heapBytes(buf.values.back());
+            if(buf.budget.isLimited() && helper::containerBytes(buf.values) + buf.heapBytes + bytes > buf.budget.bytes)
+            {
+                buf.values.pop_back();
+                throw MemoryBudgetExceeded("cache");
+            }
+            buf.heapBytes += bytes;
+            ++buf.live;
+        }
+        return index < buf.values.size();
+    }
+
+    bool isAtEnd() const
+    {
+        return !mBuffer || mIndex == npos || !isBuffered(mIndex);
+    }
+
+    /**
+     * Index of the element, end iterator is resolved to number of elements (evaluates whole range)
+     */
+    std::ptrdiff_t position() const
+    {
+        if(mIndex != npos)
+            return static_cast<std::ptrdiff_t>(mIndex);
+        if(!mBuffer)
+            return 0;
+        isBuffered(npos - 1);
+        return static_cast<std::ptrdiff_t>(mBuffer->values.size());
+    }
+
+    public:
+    CacheIt()
+        :mBuffer(nullptr), mIndex(npos)
+    { }
+
+    CacheIt(Iter first, Iter last, Allocator alloc = Allocator(), MemoryBudget budget = MemoryBudget())
+        :mBuffer(std::allocate_shared<Buffer>(alloc, Buffer{std::move(first), std::move(last), Values(alloc), false, budget, 0})), mIndex(0)
+    { }
+
+    CacheIt(const CacheIt& other, std::size_t index)
+        :mBuffer(other.mBuffer), mIndex(index)
+    { }
+
+    CacheIt& operator++()
+    {
+        ++mIndex;
+        return *this;
+    }
+
+    CacheIt operator++(int)
+    {
+        auto tmp = *this;
+        ++mIndex;
+        return tmp;
+    }
+
+    CacheIt& operator--()
+    {
+        mIndex = static_cast<std::size_t>(position() - 1);
+        return *this;
+    }
+
+    CacheIt operator--(int)
+    {
+        auto tmp = *this;
+        --*this;
+        return tmp;
+    }
+
+    CacheIt& operator+=(std::ptrdiff_t n)
+    {
+        mIndex = static_cast<std::size_t>(position() + n);
+        return *this;
+    }
+
+    CacheIt& operator-=(std::ptrdiff_t n)
+    {
+        return *this += -n;
+    }
+
+    CacheIt operator+(std::ptrdiff_t n) const
+    {
+        auto tmp = *this;
+        return tmp += n;
+    }
+
+    CacheIt operator-(std::ptrdiff_t n) const
+    {
+        auto tmp = *this;
+        return tmp -= n;
+    }
+
+    std::ptrdiff_t operator-(const CacheIt& other) const
+    {
+        return position() - other.position();
+    }
+
+    const Result& operator*() const
+    {
+        isBuffered(mIndex);
+        return mBuffer->values[mIndex];
+    }
 
-    ZipIt(Iter1 dataIterator1, Iter2 dataIterator2, tBinFunc binaryFunction)
-        :mDataIterator1(std::make_unique<Iter1>(dataIterator1)), mDataIterator2(std::make_unique<Iter2>(dataIterator2)),
-          mBinaryFunction(binaryFunction), mLastResult(nullptr), mIsResultActual(false)
-    { }
+    const Result* operator->() const
+    {
+        return &(operator*());
+    }
 
-    ZipIt(const ZipIt& other)
-        :mDataIterator1(other.mDataIterator1 ? std::make_unique<Iter1>(*other.mDataIterator1) : nullptr),
-          mDataIterator2(other.mDataIterator2 ? std::make_unique<Iter2>(*other.mDataIterator2) : nullptr),
-          mBinaryFunction(other.mBinaryFunction),
-          mLastResult(other.mLastResult ? std::make_unique<Result>(*other.mLastResult) : nullptr),
-          mIsResultActual(other.mIsResultActual)
-    { }
+    /**
+     * Bytes held by shared state (buffered elements) and by stages it reads from
+     */
+    std::size_t memory_usage() const
+    {
+        if(!mBuffer)
+            return 0;
+        return sizeof(Buffer) + helper::containerBytes(mBuffer->values) + mBuffer->heapBytes + helper::memoryUsage(mBuffer->live);
+    }
 
-    ZipIt& operator=(ZipIt other)
+    const Result& operator[](std::ptrdiff_t n) const
     {
-        swap(other);
-        return *this;
+        return *(*this + n);
     }
 
-    ZipIt& operator++()
+    /**
+     * Number of elements evaluated so far (all of them after the first full pass)
+     */
+    std::size_t buffered() const
     {
-        makeStep();
+        return mBuffer ? mBuffer->values.size() : 0;
+    }
+
+    bool operator==(const CacheIt& other) const
+    {
+        bool atEnd = isAtEnd();
+        bool otherAtEnd = other.isAtEnd();
+        if(atEnd || otherAtEnd)
+            return atEnd == otherAtEnd;
+        return mBuffer == other.mBuffer && mIndex == other.mIndex;
+    }
+
+    bool operator!=(const CacheIt& other) const
+    {
+        return !(*this == other);
+    }
+
+    bool operator<(const CacheIt& other) const
+    {
+        return position() < other.position();
+    }
+
+    bool operator>(const CacheIt& other) const
+    {
+        return other < *this;
+    }
+
+    bool operator<=(const CacheIt& other) const
+    {
+        return !(other < *this);
+    }
+
+    bool operator>=(const CacheIt& other) const
+    {
+        return !(*this < other);
+    }
+};
+
+template<typename Iter, typename Allocator>
+CacheIt<Iter, Allocator> operator+(std::ptrdiff_t n, const CacheIt<Iter, Allocator>& it)
+{
+    return it + n;
+}
+
+/**
+ * TeeIt is iterator for tee function
+ * Several consumers read the same underlying range which is traversed only once, elements are kept
+ * in a window (std::deque used as ring buffer) shared by consumers and dropped as soon as all consumers
+ * passed them, so memory is bounded by the largest gap between consumers
+ * The element a consumer has just passed is kept, so copy returned by postfix ++ can still read it (*it++)
+ * Each consumer range is single-pass, iterator tag is std::input_iterator_tag
+ */
+template<typename Iter>
+class TeeIt : public std::iterator<std::input_iterator_tag, typename std::iterator_traits<Iter>::value_type>
+{
+    private:
+    using Result = typename std::iterator_traits<Iter>::value_type;
+
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    struct Window
+    {
+        Iter live;
+        Iter end;
+        std::deque<Result> values;
+        std::size_t first;
+        std::vector<std::size_t> positions;
+        bool complete;
+        MemoryBudget budget;
+        std::size_t heapBytes;
+    };
+
+    std::shared_ptr<Window> mWindow;
+    std::size_t mConsumer;
+    std::size_t mIndex;
+
+    /**
+     * Evaluates underlying range until element with given index is in the window or the end is reached
+     * Element which would exceed the budget is not added and MemoryBudgetExceeded is thrown
+     */
+    bool isAvailable(std::size_t index) const
+    {
+        auto& win = *mWindow;
+        while(win.first + win.values.size() <= index && !win.complete)
+        {
+            if(win.live == win.end)
+            {
+                win.complete = true;
+                break;
+            }
+            win.values.push_back(*win.live);
+            auto bytes = helper::heapBytes(win.values.back());
+            if(win.budget.isLimited() && helper::containerBytes(win.values) + win.heapBytes + bytes > win.budget.bytes)
+            {
+                win.values.pop_back();
+                throw MemoryBudgetExceeded("tee");
+            }
+            win.heapBytes += bytes;
+            ++win.live;
+        }
+        return index < win.first + win.values.size();
+    }
+
+    /**
+     * Tells whether element with given index exists, it is not evaluated (only elements before it),
+     * so comparison with end does not add the next element to the window
+     */
+    bool exists(std::size_t index) const
+    {
+        auto& win = *mWindow;
+        if(index > win.first + win.values.size())
+            isAvailable(index - 1);
+        auto buffered = win.first + win.values.size();
+        return index < buffered || (index == buffered && !win.complete && win.live != win.end);
+    }
+
+    bool isAtEnd() const
+    {
+        return !mWindow || mIndex == npos || !exists(mIndex);
+    }
+
+    /**
+     * Drops elements already passed by all consumers, except the last one passed by each of them
+     */
+    void release()
+    {
+        auto& win = *mWindow;
+        win.positions[mConsumer] = std::max(win.positions[mConsumer], mIndex - 1);
+        auto slowest = *std::min_element(win.positions.begin(), win.positions.end());
+        while(win.first < slowest && !win.values.empty())
+        {
+            win.heapBytes -= helper::heapBytes(win.values.front());
+            win.values.pop_front();
+            ++win.first;
+        }
+    }
+
+    public:
+    TeeIt()
+        :mWindow(nullptr), mConsumer(0), mIndex(npos)
+    { }
+
+    TeeIt(Iter first, Iter last, std::size_t consumers, MemoryBudget budget = MemoryBudget())
+        :mWindow(std::make_shared<Window>(Window{std::move(first), std::move(last), std::deque<Result>(), 0,
+                                                 std::vector<std::size_t>(consumers, 0), false, budget, 0})),
+          mConsumer(0), mIndex(0)
+    { }
+
+    TeeIt(const TeeIt& other, std::size_t consumer, std::size_t index)
+        :mWindow(other.mWindow), mConsumer(consumer), mIndex(index)
+    { }
+
+    TeeIt& operator++()
+    {
+        ++mIndex;
+        release();
         return *this;
     }
 
-    ZipIt operator++(int)
+    TeeIt operator++(int)
     {
         auto tmp = *this;
-        makeStep();
+        ++*this;
         return tmp;
     }
 
-    const Result& operator*()
+    /**
+     * Throws std::logic_error when the element was already dropped from the window (e.g. begin() of consumer
+     * range was called again after the consumer moved on)
+     */
+    const Result& operator*() const
     {
-        if(mIsResultActual)
-            return *mLastResult;
-
-        auto origData1 = *(*mDataIterator1);
-        auto origData2 = *(*mDataIterator2);
-        if(!mLastResult)
-            mLastResult = std::make_unique<Result>(mBinaryFunction(origData1, origData2));
-        else
-            *mLastResult = mBinaryFunction(origData1, origData2);
-        mIsResultActual = true;
-        return *mLastResult;
+        if(mIndex < mWindow->first)
+            throw std::logic_error("tee: element was already released, consumer ranges are single-pass");
+        isAvailable(mIndex);
+        return mWindow->values[mIndex - mWindow->first];
     }
 
-    const Result* operator->()
+    const Result* operator->() const
     {
         return &(operator*());
     }
 
-    ~ZipIt() = default;
+    /**
+     * Bytes held by shared window and by stages it reads from
+     */
+    std::size_t memory_usage() const
+    {
+        if(!mWindow)
+            return 0;
+        return sizeof(Window) + helper::containerBytes(mWindow->values) + mWindow->heapBytes + helper::containerBytes(mWindow->positions) +
+               helper::memoryUsage(mWindow->live);
+    }
+
+    /**
+     * Number of elements currently held for consumers
+     */
+    std::size_t buffered() const
+    {
+        return mWindow ? mWindow->values.size() : 0;
+    }
 
-    template<typename I1, typename I2, typename R>
-    friend bool operator==(const ZipIt<I1, I2, R>&, const ZipIt<I1, I2, R>&);
+    bool operator==(const TeeIt& other) const
+    {
+        bool atEnd = isAtEnd();
+        bool otherAtEnd = other.isAtEnd();
+        if(atEnd || otherAtEnd)
+            return atEnd == otherAtEnd;
+        return mWindow == other.mWindow && mIndex == other.mIndex;
+    }
 
-    template<typename I1, typename I2, typename R>
-    friend bool operator!=(const ZipIt<I1, I2, R>&, const ZipIt<I1, I2, R>&);
+    bool operator!=(const TeeIt& other) const
+    {
+        return !(*this == other);
+    }
 };
 
-template<typename I1, typename I2, typename R>
-bool operator==(const ZipIt<I1, I2, R>& lhs, const ZipIt<I1, I2, R>& rhs)
+/**
+ * ZipTupleIt is iterator for variadic zip function
+ * Holds any number of iterators directly (no heap state, no cached result) and yields tuple of references
+ * to their current elements, so struct-of-arrays columns can be traversed as rows
+ * Like ZipIt, it is at the end as soon as any of underlying iterators is
+ * Iterator tag is std::input_iterator_tag if any of iterators is input one, otherwise std::forward_iterator_tag
+ */
+template<typename... Iters>
+class ZipTupleIt : public std::iterator<helper::weakestIteratorType<Iters...>,
+                                        std::tuple<decltype(*std::declval<Iters&>())...>,
+                                        std::ptrdiff_t,
+                                        void,
+                                        std::tuple<decltype(*std::declval<Iters&>())...> >
 {
-    return (lhs.mDataIterator1 && rhs.mDataIterator1 ? *lhs.mDataIterator1 == *rhs.mDataIterator1 : lhs.mDataIterator1 == rhs.mDataIterator1) ||
-            (lhs.mDataIterator2 && rhs.mDataIterator2 ? *lhs.mDataIterator2 == *rhs.mDataIterator2 : lhs.mDataIterator2 == rhs.mDataIterator2);
-}
+    private:
+    using Result = std::tuple<decltype(*std::declval<Iters&>())...>;
+    using tIndices = std::index_sequence_for<Iters...>;
 
-template<typename I1, typename I2, typename R>
-bool operator!=(const ZipIt<I1, I2, R>& lhs, const ZipIt<I1, I2, R>& rhs)
-{
-    return !(lhs == rhs);
-}
+    std::tuple<Iters...> mDataIterators;
+
+    template<std::size_t... I>
+    void makeStep(std::index_sequence<I...>)
+    {
+        (void)std::initializer_list<int>{ (++std::get<I>(mDataIterators), 0)... };
+    }
+
+    template<std::size_t... I>
+    Result dereference(std::index_sequence<I...>)
+    {
+        return Result(*std::get<I>(mDataIterators)...);
+    }
+
+    template<std::size_t... I>
+    bool anyEqual(const ZipTupleIt& other, std::index_sequence<I...>) const
+    {
+        return helper::anyOf(std::get<I>(mDataIterators) == std::get<I>(other.mDataIterators)...);
+    }
+
+    public:
+    ZipTupleIt() = default;
+
+    explicit ZipTupleIt(Iters... dataIterators)
+        :mDataIterators(std::move(dataIterators)...)
+    { }
+
+    ZipTupleIt& operator++()
+    {
+        makeStep(tIndices());
+        return *this;
+    }
+
+    ZipTupleIt operator++(int)
+    {
+        auto tmp = *this;
+        makeStep(tIndices());
+        return tmp;
+    }
+
+    Result operator*()
+    {
+        return dereference(tIndices());
+    }
+
+    bool operator==(const ZipTupleIt& other) const
+    {
+        return sizeof...(Iters) == 0 || anyEqual(other, tIndices());
+    }
+
+    bool operator!=(const ZipTupleIt& other) const
+    {
+        return !(*this == other);
+    }
+};
 
 
 /**
  * FUNCTIONS
  * map, filter, zip, unique
+ * Optional last argument of map, filter, zip and unique is statistics policy, e.g. lazy::Counting(stats)
  */
 
-template<typename Iterator, typename UnaryFunction>
-auto map(Iterator first, Iterator last, UnaryFunction f)
+template<typename Iterator, typename UnaryFunction, typename Stats = NoStats>
+auto map(Iterator first, Iterator last, UnaryFunction f, Stats stats = Stats())
+{
+    using It = MapIt<Iterator, helper::invokeResult<UnaryFunction, helper::valueType<Iterator>>, Stats>;
+    It beginIt(std::move(first), f, stats);
+    It endIt(std::move(last), std::move(f), std::move(stats));
+
+    return Range<It>(std::move(beginIt), std::move(endIt));
+}
+
+
+/**
+ * f(const T& in, R& out) writes result for each element into out, which is reused between elements
+ * R is deduced from f, it has to be given explicitly (map_into<R>) for generic lambdas
+ */
+template<typename Result = void, typename Iterator, typename OutputFunction>
+auto map_into(Iterator first, Iterator last, OutputFunction f)
 {
-    MapIt<Iterator, typename std::result_of<UnaryFunction(typename std::iterator_traits<Iterator>::value_type)>::type> beginIt(first, f);
-    MapIt<Iterator, typename std::result_of<UnaryFunction(typename std::iterator_traits<Iterator>::value_type)>::type> endIt(last, f);
+    using R = typename helper::mapIntoResult<Result, OutputFunction>::type;
+    MapIntoIt<Iterator, R> beginIt(first, f);
+    MapIntoIt<Iterator, R> endIt(last, f);
 
-    return Range< MapIt<Iterator, typename std::result_of<UnaryFunction(typename std::iterator_traits<Iterator>::value_type)>::type> >(beginIt, endIt);
+    return Range< MapIntoIt<Iterator, R> >(std::move(beginIt), std::move(endIt));
 }
 
 
-template<typename Iterator, typename UnaryPredicate>
-auto filter(Iterator first, Iterator last, UnaryPredicate p)
+template<typename Iterator, typename UnaryPredicate, typename Stats = NoStats>
+auto filter(Iterator first, Iterator last, UnaryPredicate p, Stats stats = Stats())
 {
-    FilterIt<Iterator> beginIt(first, last, p);
-    FilterIt<Iterator> endIt(last, last, p);
+    FilterIt<Iterator, Stats> beginIt(first, last, p, stats);
+    FilterIt<Iterator, Stats> endIt(last, last, p, std::move(stats));
 
-    return Range< FilterIt<Iterator> >(beginIt, endIt);
+    return Range< FilterIt<Iterator, Stats> >(std::move(beginIt), std::move(endIt));
 }
 
 
-template< typename Iterator1, typename Iterator2, typename BinaryFunction >
+template< typename Iterator1, typename Iterator2, typename BinaryFunction, typename Stats = NoStats >
 auto zip(Iterator1 first1, Iterator1 last1,
          Iterator2 first2, Iterator2 last2,
-         BinaryFunction f)
+         BinaryFunction f, Stats stats = Stats())
+{
+    using It = ZipIt<Iterator1, Iterator2, helper::invokeResult<BinaryFunction, helper::valueType<Iterator1>, helper::valueType<Iterator2>>, Stats>;
+    It beginIt(std::move(first1), std::move(first2), f, stats);
+    It endIt(std::move(last1), std::move(last2), std::move(f), std::move(stats));
+
+    return Range<It>(std::move(beginIt), std::move(endIt));
+}
+
+
+/**
+ * Projects each element of range to one of its members, e.g. project(first, last, &Record::price)
+ * Elements are accessed by reference, so underlying iterator has to return reference to stored element
+ */
+template< typename Iterator, typename Record, typename Field >
+auto project( Iterator first, Iterator last, Field Record::* member )
+{
+    return Range< ProjectIt<Iterator, Field> >(ProjectIt<Iterator, Field>(std::move(first), member),
+                                               ProjectIt<Iterator, Field>(std::move(last), member));
+}
+
+
+/**
+ * Opt-in caching of filter/unique selection - first full pass records positions of selected elements,
+ * every other pass over the returned range only visits them
+ */
+template< typename Iterator, typename Stats >
+auto cache_selection( FilterIt<Iterator, Stats> first, FilterIt<Iterator, Stats> last )
+{
+    SelectionIt< FilterIt<Iterator, Stats> > beginIt(std::move(first), std::move(last));
+    SelectionIt< FilterIt<Iterator, Stats> > endIt(beginIt, static_cast<std::size_t>(-1));
+
+    return Range< SelectionIt< FilterIt<Iterator, Stats> > >(std::move(beginIt), std::move(endIt));
+}
+
+
+/**
+ * Materializes elements of given range on demand, so the (possibly single-pass) range together with all
+ * stages producing it is evaluated exactly once, no matter how many times the returned range is traversed
+ * Buffered elements are allocated by given allocator, e.g. lazy::ArenaAllocator<int>(arena) which has to outlive the range
+ * Memory budget limits the buffer, MemoryBudgetExceeded is thrown by the access which would exceed it
+ */
+template< typename Iterator, typename Allocator = std::allocator<helper::valueType<Iterator>> >
+auto cache( Iterator first, Iterator last, MemoryBudget budget, Allocator alloc = Allocator() )
 {
-    ZipIt<Iterator1, Iterator2, typename std::result_of<BinaryFunction(typename std::iterator_traits<Iterator1>::value_type, typename std::iterator_traits<Iterator2>::value_type)>::type> beginIt(first1, first2, f);
-    ZipIt<Iterator1, Iterator2, typename std::result_of<BinaryFunction(typename std::iterator_traits<Iterator1>::value_type, typename std::iterator_traits<Iterator2>::value_type)>::type> endIt(last1, last2, f);
+    using It = CacheIt<Iterator, Allocator>;
+    It beginIt(std::move(first), std::move(last), std::move(alloc), budget);
+    It endIt(beginIt, static_cast<std::size_t>(-1));
+
+    return Range<It>(std::move(beginIt), std::move(endIt));
+}
 
-    return Range< ZipIt<Iterator1, Iterator2, typename std::result_of<BinaryFunction(typename std::iterator_traits<Iterator1>::value_type, typename std::iterator_traits<Iterator2>::value_type)>::type> >(beginIt, endIt);
+template< typename Iterator, typename Allocator = std::allocator<helper::valueType<Iterator>> >
+auto cache( Iterator first, Iterator last, Allocator alloc = Allocator() )
+{
+    return cache(std::move(first), std::move(last), MemoryBudget(), std::move(alloc));
 }
 
 
+/**
+ * Splits given range to k single-pass ranges which share one traversal of the original range
+ * Memory budget limits the window of elements between the slowest and the fastest consumer
+ */
 template< typename Iterator >
-auto unique( Iterator first, Iterator last )
+auto tee( Iterator first, Iterator last, std::size_t k, MemoryBudget budget = MemoryBudget() )
+{
+    TeeIt<Iterator> shared(std::move(first), std::move(last), k, budget);
+
+    std::vector< Range< TeeIt<Iterator> > > ranges;
+    ranges.reserve(k);
+    for(std::size_t i = 0; i < k; ++i)
+        ranges.emplace_back(TeeIt<Iterator>(shared, i, 0), TeeIt<Iterator>(shared, i, static_cast<std::size_t>(-1)));
+    return ranges;
+}
+
+
+/**
+ * Zips any number of ranges (containers or lazy ranges) into range of tuples of references to their elements
+ * Elements are not copied, resulting range is as long as the shortest of given ones
+ */
+template< typename... Ranges,
+          typename = typename std::enable_if<sizeof...(Ranges) != 0 && helper::allRanges<Ranges...>()>::type >
+auto zip(Ranges&&... ranges)
+{
+    using Iter = ZipTupleIt<decltype(std::begin(ranges))...>;
+
+    return Range<Iter>(Iter(std::begin(ranges)...), Iter(std::end(ranges)...));
+}
+
+/**
+ * Applies N-ary function to elements of zipped ranges
+ */
+template< typename NaryFunction, typename... Ranges,
+          typename = typename std::enable_if<!helper::isRange<NaryFunction>::value && sizeof...(Ranges) != 0 && helper::allRanges<Ranges...>()>::type >
+auto zip(NaryFunction f, Ranges&&... ranges)
+{
+    auto z = zip(std::forward<Ranges>(ranges)...);
+    return map(z.begin(), z.end(), [f](const auto& t) mutable {return helper::applyTuple(f, t);});
+}
+
+
+/**
+ * Memory budget limits size of the set of seen values (see MemoryBudget)
+ * Set of seen values is allocated by given allocator, e.g. lazy::ArenaAllocator<int>(arena) - the arena has
+ * to outlive the range, each copy of begin iterator copies the set into it
+ * With monotonic allocator (arena) copies of iterator share one set instead, so the range can be traversed only once
+ */
+template< typename Iterator, typename Stats = NoStats, typename Allocator = std::allocator<helper::valueType<Iterator>> >
+auto unique( Iterator first, Iterator last, MemoryBudget budget, Stats stats = Stats(), Allocator alloc = Allocator() )
+{
+    using Func = helper::UniqueFunc<helper::valueType<Iterator>, Stats,
+                                    typename std::allocator_traits<Allocator>::template rebind_alloc<helper::valueType<Iterator>>>;
+    // The predicate is stored in std::function of the iterator, only unique knows its exact type
+    auto seenBytes = [](const auto& predicate) -> std::size_t {return predicate.template target<Func>()->memory_usage();};
+    FilterIt<Iterator, Stats> beginIt(first, last, Func(stats, budget, std::move(alloc)), stats, seenBytes);
+    // End iterator never evaluates predicate, without the set its copies (e.g. end() in loop condition) are cheaper
+    FilterIt<Iterator, Stats> endIt(last, last, nullptr, std::move(stats));
+
+    return Range< FilterIt<Iterator, Stats> >(std::move(beginIt), std::move(endIt));
+}
+
+template< typename Iterator, typename Stats = NoStats >
+auto unique( Iterator first, Iterator last, Stats stats = Stats() )
+{
+    return unique(std::move(first), std::move(last), MemoryBudget(), std::move(stats));
+}
+
+
+/**
+ * CONTAINERS
+ */
+
+/**
+ * Columnar is struct-of-arrays container - each field of record is stored in its own contiguous array
+ * column<I>() provides range over one field (usable by map, filter, zip, ...), so scans touching
+ * only few fields read only their data; begin() & end() iterate whole rows as tuples of references
+ */
+template<typename... Ts>
+class Columnar
 {
-    FilterIt<Iterator> beginIt(first, last, helper::UniqueFunc<typename std::iterator_traits<Iterator>::value_type>());
-    FilterIt<Iterator> endIt(last, last, helper::UniqueFunc<typename std::iterator_traits<Iterator>::value_type>());
+    private:
+    using tColumns = std::tuple<std::vector<Ts>...>;
+    using tIndices = std::index_sequence_for<Ts...>;
+
+    tColumns mColumns;
+
+    template<std::size_t... I>
+    void pushRow(std::index_sequence<I...>, Ts... values)
+    {
+        (void)std::initializer_list<int>{ (std::get<I>(mColumns).push_back(std::move(values)), 0)... };
+    }
+
+    template<std::size_t... I>
+    void reserveAll(std::size_t n, std::index_sequence<I...>)
+    {
+        (void)std::initializer_list<int>{ (std::get<I>(mColumns).reserve(n), 0)... };
+    }
+
+    template<std::size_t... I>
+    void clearAll(std::index_sequence<I...>)
+    {
+        (void)std::initializer_list<int>{ (std::get<I>(mColumns).clear(), 0)... };
+    }
+
+    template<typename Cols, std::size_t... I>
+    static auto rowsBegin(Cols& cols, std::index_sequence<I...>)
+    {
+        return ZipTupleIt<decltype(std::get<I>(cols).begin())...>(std::get<I>(cols).begin()...);
+    }
+
+    template<typename Cols, std::size_t... I>
+    static auto rowsEnd(Cols& cols, std::index_sequence<I...>)
+    {
+        return ZipTupleIt<decltype(std::get<I>(cols).end())...>(std::get<I>(cols).end()...);
+    }
+
+    public:
+    template<std::size_t I>
+    using column_type = typename std::tuple_element<I, std::tuple<Ts...>>::type;
+
+    Columnar() = default;
+
+    void push_back(Ts... values)
+    {
+        pushRow(tIndices(), std::move(values)...);
+    }
+
+    void reserve(std::size_t n)
+    {
+        reserveAll(n, tIndices());
+    }
+
+    void clear()
+    {
+        clearAll(tIndices());
+    }
+
+    std::size_t size() const
+    {
+        return std::get<0>(mColumns).size();
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    template<std::size_t I>
+    auto column()
+    {
+        auto& col = std::get<I>(mColumns);
+        return Range<typename std::vector<column_type<I>>::iterator>(col.begin(), col.end());
+    }
+
+    template<std::size_t I>
+    auto column() const
+    {
+        const auto& col = std::get<I>(mColumns);
+        return Range<typename std::vector<column_type<I>>::const_iterator>(col.begin(), col.end());
+    }
+
+    /**
+     * Direct access to underlying array of one field
+     */
+    template<std::size_t I>
+    const std::vector<column_type<I>>& data() const
+    {
+        return std::get<I>(mColumns);
+    }
+
+    auto begin()
+    {
+        return rowsBegin(mColumns, tIndices());
+    }
+
+    auto end()
+    {
+        return rowsEnd(mColumns, tIndices());
+    }
+
+    auto begin() const
+    {
+        return rowsBegin(mColumns, tIndices());
+    }
+
+    auto end() const
+    {
+        return rowsEnd(mColumns, tIndices());
+    }
+};
 
-    return Range< FilterIt<Iterator> >(beginIt, endIt);
+/**
+ * Splits records from given range into Columnar container, one column per given member pointer
+ */
+template<typename Iterator, typename Record, typename... Fields>
+Columnar<Fields...> columnar(Iterator first, Iterator last, Fields Record::*... fields)
+{
+    Columnar<Fields...> result;
+    for(; first != last; ++first)
+    {
+        const Record& record = *first;
+        result.push_back(record.*fields...);
+    }
+    return result;
 }
 
 
@@ -0,0 +1,419 @@
+/*
+ * HW01, lazy functional library - type-erased ranges
+ * Author: David Kuťák, 433409
+ *
+ * any_range<T> hides exact type of pipeline (MapIt<FilterIt<...>>), so it can appear in headers
+ * and be passed across module boundaries
+ */
+#pragma once
+
+#include "lazy.h"
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+
+namespace lazy
+{
+
+namespace helper
+{
+
+/**
+ * Table of operations of erased iterator, there is one constant table per iterator type
+ * Operations get storage of any_iterator, which holds the iterator itself or pointer to it
+ * relocate moves iterator to uninitialized storage and leaves the source storage empty
+ * read copies up to max elements to out and advances the iterator, it stops at end (of the same type)
+ */
+template<typename T>
+struct AnyIteratorOps
+{
+    // Identity of the wrapped iterator type
+    const std::type_info* type;
+    void (*copy)(const void* from, void* to);
+    void (*relocate)(void* from, void* to);
+    void (*destroy)(void* self);
+    void (*increment)(void* self);
+    T (*dereference)(void* self);
+    bool (*equal)(const void* self, const void* other);
+    std::size_t (*read)(void* self, const void* end, T* out, std::size_t max);
+    std::size_t (*memoryUsage)(const void* self);
+};
+
+/**
+ * Tables of the same iterator type may be different objects when they come from different shared libraries,
+ * then they are matched by the type identity
+ */
+template<typename T>
+bool sameIteratorType(const AnyIteratorOps<T>* a, const AnyIteratorOps<T>* b)
+{
+    return a == b || (a && b && *a->type == *b->type);
+}
+
+/**
+ * Checks if I is iterator whose elements are convertible to T
+ */
+template<typename I, typename T, typename = void>
+struct isIteratorOf : std::false_type {};
+
+template<typename I, typename T>
+struct isIteratorOf<I, T, decltype(++std::declval<I&>(), void())>
+    : std::is_convertible<decltype(*std::declval<I&>()), T> {};
+
+/**
+ * Places iterator into the storage of any_iterator or to the heap when it does not fit
+ */
+template<typename I, bool isInline>
+struct AnyStorage
+{
+    static I& get(void* storage)
+    {
+        return *static_cast<I*>(storage);
+    }
+
+    static const I& get(const void* storage)
+    {
+        return *static_cast<const I*>(storage);
+    }
+
+    static void create(void* storage, I it)
+    {
+        new (storage) I(std::move(it));
+    }
+
+    static void relocate(void* from, void* to)
+    {
+        new (to) I(std::move(get(from)));
+        get(from).~I();
+    }
+
+    static void destroy(void* storage)
+    {
+        get(storage).~I();
+    }
+
+    static std::size_t heapBytes()
+    {
+        return 0;
+    }
+};
+
+template<typename I>
+struct AnyStorage<I, false>
+{
+    static I& get(void* storage)
+    {
+        return **static_cast<I**>(storage);
+    }
+
+    static const I& get(const void* storage)
+    {
+        return **static_cast<I* const*>(storage);
+    }
+
+    static void create(void* storage, I it)
+    {
+        new (storage) I*(new I(std::move(it)));
+    }
+
+    static void relocate(void* from, void* to)
+    {
+        new (to) I*(*static_cast<I**>(from));
+    }
+
+    static void destroy(void* storage)
+    {
+        delete *static_cast<I**>(storage);
+    }
+
+    static std::size_t heapBytes()
+    {
+        return sizeof(I);
+    }
+};
+
+template<typename T, typename I, bool isInline>
+struct AnyIteratorImpl
+{
+    using Storage = AnyStorage<I, isInline>;
+
+    static void copy(const void* from, void* to)
+    {
+        Storage::create(to, Storage::get(from));
+    }
+
+    static void increment(void* self)
+    {
+        ++Storage::get(self);
+    }
+
+    static T dereference(void* self)
+    {
+        return *Storage::get(self);
+    }
+
+    static bool equal(const void* self, const void* other)
+    {
+        return Storage::get(self) == Storage::get(other);
+    }
+
+    static std::size_t read(void* self, const void* end, T* out, std::size_t max)
+    {
+        auto& it = Storage::get(self);
+        const auto& last = Storage::get(end);
+        std::size_t n = 0;
+        for(; n < max && it != last; ++n, ++it)
+            out[n] = *it;
+        return n;
+    }
+
+    static std::size_t memoryUsage(const void* self)
+    {
+        return Storage::heapBytes() + helper::memoryUsage(Storage::get(self));
+    }
+
+    // Static member of class template is one object in the whole program (but not across shared libraries,
+    // see sameIteratorType)
+    static const AnyIteratorOps<T> ops;
+};
+
+template<typename T, typename I, bool isInline>
+const AnyIteratorOps<T> AnyIteratorImpl<T, I, isInline>::ops = {
+    &typeid(I),
+    &AnyIteratorImpl<T, I, isInline>::copy,
+    &AnyStorage<I, isInline>::relocate,
+    &AnyStorage<I, isInline>::destroy,
+    &AnyIteratorImpl<T, I, isInline>::increment,
+    &AnyIteratorImpl<T, I, isInline>::dereference,
+    &AnyIteratorImpl<T, I, isInline>::equal,
+    &AnyIteratorImpl<T, I, isInline>::read,
+    &AnyIteratorImpl<T, I, isInline>::memoryUsage
+};
+
+}
+
+/**
+ * Single-pass iterator over elements convertible to T, hiding type of the underlying iterator
+ * Iterators up to inlineBytes are stored in place (no heap allocation), bigger ones on the heap
+ * Each ++, * and == is one indirect call, read() copies whole batch of elements in one call
+ * Elements are returned by value, iterators are equal only if they wrap the same type and its iterators are equal
+ */
+template<typename T>
+class any_iterator : public std::iterator<std::input_iterator_tag, T, std::ptrdiff_t, const T*, T>
+{
+    public:
+    static constexpr std::size_t inlineBytes = 64;
+
+    private:
+    template<typename I>
+    using fitsInline = std::integral_constant<bool, sizeof(I) <= inlineBytes && alignof(I) <= alignof(std::max_align_t)>;
+
+    template<typename I>
+    using isSelf = std::is_same<typename std::decay<I>::type, any_iterator>;
+
+    alignas(std::max_align_t) unsigned char mStorage[inlineBytes];
+    const helper::AnyIteratorOps<T>* mOps;
+
+    void reset()
+    {
+        if(mOps)
+            mOps->destroy(mStorage);
+        mOps = nullptr;
+    }
+
+    public:
+    any_iterator()
+        :mOps(nullptr)
+    { }
+
+    template<typename I, typename = typename std::enable_if<!isSelf<I>::value && helper::isIteratorOf<I, T>::value>::type>
+    any_iterator(I it)
+        :mOps(&helper::AnyIteratorImpl<T, I, fitsInline<I>::value>::ops)
+    {
+        helper::AnyStorage<I, fitsInline<I>::value>::create(mStorage, std::move(it));
+    }
+
+    any_iterator(const any_iterator& other)
+        :mOps(nullptr)
+    {
+        if(other.mOps)
+            other.mOps->copy(other.mStorage, mStorage);
+        mOps = other.mOps;
+    }
+
+    any_iterator(any_iterator&& other)
+        :mOps(nullptr)
+    {
+        if(other.mOps)
+            other.mOps->relocate(other.mStorage, mStorage);
+        mOps = other.mOps;
+        other.mOps = nullptr;
+    }
+
+    any_iterator& operator=(const any_iterator& other)
+    {
+        if(this != &other)
+        {
+            any_iterator copy(other);
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+
+    any_iterator& operator=(any_iterator&& other)
+    {
+        if(this != &other)
+        {
+            reset();
+            if(other.mOps)
+                other.mOps->relocate(other.mStorage, mStorage);
+            mOps = other.mOps;
+            other.mOps = nullptr;
+        }
+        return *this;
+    }
+
+    any_iterator& operator++()
+    {
+        mOps->increment(mStorage);
+        return *this;
+    }
+
+    any_iterator operator++(int)
+    {
+        any_iterator copy(*this);
+        ++*this;
+        return copy;
+    }
+
+    T operator*() const
+    {
+        return mOps->dereference(const_cast<unsigned char*>(mStorage));
+    }
+
+    bool operator==(const any_iterator& other) const
+    {
+        if(!helper::sameIteratorType(mOps, other.mOps))
+            return false;
+        return !mOps || mOps->equal(mStorage, other.mStorage);
+    }
+
+    bool operator!=(const any_iterator& other) const
+    {
+        return !(*this == other);
+    }
+
+    /**
+     * Copies up to max elements to out and advances past them, stops at end
+     * It is one indirect call for iterators of the same type, elements are copied by assignment
+     */
+    std::size_t read(T* out, std::size_t max, const any_iterator& end)
+    {
+        if(mOps && helper::sameIteratorType(mOps, end.mOps))
+            return mOps->read(mStorage, end.mStorage, out, max);
+
+        std::size_t n = 0;
+        for(; n < max && *this != end; ++n, ++*this)
+            out[n] = **this;
+        return n;
+    }
+
+    /**
+     * Heap bytes of the wrapped iterator (if it did not fit inline) and bytes held by stages it reads from
+     */
+    std::size_t memory_usage() const
+    {
+        return mOps ? mOps->memoryUsage(mStorage) : 0;
+    }
+
+    ~any_iterator()
+    {
+        reset();
+    }
+};
+
+/**
+ * Range of any_iterators, constructible from any range of elements convertible to T
+ * e.g. lazy::any_range<int> evens() { ... return lazy::filter(first, last, isEven); }
+ * Like Range it is a view - containers have to outlive it, ranges of lazy stages are copied into it
+ */
+template<typename T>
+class any_range
+{
+    private:
+    any_iterator<T> mBeg;
+    any_iterator<T> mEnd;
+
+    // Batch of for_each is limited to 4 KiB of elements on the stack
+    static constexpr std::size_t batchSize = sizeof(T) < 64 ? 64 : (sizeof(T) < 4096 ? 4096 / sizeof(T) : 1);
+
+    template<typename F>
+    void forEach(F& f, std::true_type) const
+    {
+        auto it = mBeg;
+        T batch[batchSize];
+        while(auto n = it.read(batch, batchSize, mEnd))
+            for(std::size_t i = 0; i < n; ++i)
+                f(batch[i]);
+    }
+
+    template<typename F>
+    void forEach(F& f, std::false_type) const
+    {
+        for(auto it = mBeg; it != mEnd; ++it)
+            f(*it);
+    }
+
+    public:
+    typedef T value_type;
+    typedef T reference;
+    typedef const T* pointer;
+
+    any_range() = default;
+
+    template<typename I>
+    any_range(I first, I last)
+        :mBeg(std::move(first)), mEnd(std::move(last))
+    { }
+
+    template<typename R, typename = typename std::enable_if<helper::isRangeArg<R&&>::value &&
+                                                            !std::is_same<typename std::decay<R>::type, any_range>::value>::type>
+    any_range(R&& range)
+        :mBeg(std::begin(range)), mEnd(std::end(range))
+    { }
+
+    any_iterator<T> begin() const
+    {
+        return mBeg;
+    }
+
+    any_iterator<T> end() const
+    {
+        return mEnd;
+    }
+
+    /**
+     * Calls f for each element, elements are fetched in batches - one indirect call per batch
+     * (falls back to element by element walk for types which are not default constructible and assignable)
+     */
+    template<typename F>
+    void for_each(F f) const
+    {
+        forEach(f, std::integral_constant<bool, std::is_default_constructible<T>::value && std::is_copy_assignable<T>::value>());
+    }
+
+    std::size_t memory_usage() const
+    {
+        return sizeof(any_range) + mBeg.memory_usage();
+    }
+};
+
+namespace helper
+{
+template<typename T>
+struct isRangeView< any_range<T> > : std::true_type {};
+}
+
+} // namespace lazy
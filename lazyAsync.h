@@ -0,0 +1,626 @@
+/*
+ * HW01, lazy functional library - asynchronous stages
+ * Author: David Kuťák, 433409
+ *
+ * Stages evaluating elements on other threads, program has to be linked with threads library (-pthread)
+ */
+#pragma once
+
+#include "lazy.h"
+#include "lazyTrace.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace lazy
+{
+
+/**
+ * ThreadPool is fixed set of worker threads executing submitted tasks in FIFO order
+ * Tasks not started before destruction are dropped (their futures report broken promise)
+ */
+class ThreadPool
+{
+    private:
+    std::vector<std::thread> mWorkers;
+    std::deque<std::function<void()>> mTasks;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    bool mStop;
+
+    void work()
+    {
+        while(true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mCondition.wait(lock, [this]{return mStop || !mTasks.empty();});
+                if(mStop)
+                    return;
+                task = std::move(mTasks.front());
+                mTasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    public:
+    explicit ThreadPool(std::size_t threads = std::thread::hardware_concurrency())
+        :mStop(false)
+    {
+        threads = std::max<std::size_t>(threads, 1);
+        mWorkers.reserve(threads);
+        for(std::size_t i = 0; i < threads; ++i)
+            mWorkers.emplace_back([this]{work();});
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    template<typename Task>
+    auto submit(Task task) -> std::future<decltype(task())>
+    {
+        auto packaged = std::make_shared<std::packaged_task<decltype(task())()>>(std::move(task));
+        auto result = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mTasks.emplace_back([packaged]{(*packaged)();});
+        }
+        mCondition.notify_one();
+        return result;
+    }
+
+    std::size_t size() const
+    {
+        return mWorkers.size();
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+            mTasks.clear();
+        }
+        mCondition.notify_all();
+        for(auto& worker : mWorkers)
+            worker.join();
+    }
+};
+
+/**
+ * AsyncMapIt is iterator for async_map function
+ * Keeps up to depth following elements computing on thread pool while the current one is consumed,
+ * results are delivered in the original order
+ * Underlying range is read only by consumer thread, function is called concurrently on worker threads
+ * Range is single-pass, iterator tag is std::input_iterator_tag
+ */
+template<typename Iter, typename Result>
+class AsyncMapIt : public std::iterator<std::input_iterator_tag, Result>
+{
+    private:
+    using valType = typename std::iterator_traits<Iter>::value_type;
+    using tUnFunc = std::function<Result(const valType&)>;
+
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    struct Prefetch
+    {
+        Iter live;
+        Iter end;
+        std::shared_ptr<const tUnFunc> function;
+        std::size_t depth;
+        std::shared_ptr<ThreadPool> pool;
+        std::deque<std::future<Result>> pending;
+        std::size_t first;
+        std::unique_ptr<Result> current;
+        std::size_t currentIndex;
+        // Exception thrown by function for element currentIndex
+        std::exception_ptr error;
+
+        ~Prefetch()
+        {
+            // Running tasks must not outlive the consumer
+            for(auto& result : pending)
+                if(result.valid())
+                    result.wait();
+        }
+    };
+
+    std::shared_ptr<Prefetch> mPrefetch;
+    std::size_t mIndex;
+
+    static void fill(Prefetch& pre)
+    {
+        while(pre.pending.size() < pre.depth && pre.live != pre.end)
+        {
+            auto function = pre.function;
+            valType value = *pre.live;
+            pre.pending.push_back(pre.pool->submit([function, value]{
+                trace::Span span("async_map", "async");
+                return (*function)(value);
+            }));
+            ++pre.live;
+        }
+    }
+
+    /**
+     * Prefetches until element with given index is the next one to be delivered, skipped elements are dropped
+     */
+    bool reach(std::size_t index) const
+    {
+        auto& pre = *mPrefetch;
+        if(pre.currentIndex == index)
+            return true;
+        fill(pre);
+        while(pre.first < index && !pre.pending.empty())
+        {
+            pre.pending.front().wait();
+            pre.pending.pop_front();
+            ++pre.first;
+            fill(pre);
+        }
+        return pre.first == index && !pre.pending.empty();
+    }
+
+    bool isAtEnd() const
+    {
+        return !mPrefetch || mIndex == npos || !reach(mIndex);
+    }
+
+    public:
+    AsyncMapIt()
+        :mPrefetch(nullptr), mIndex(npos)
+    { }
+
+    AsyncMapIt(Iter first, Iter last, tUnFunc function, std::size_t depth, std::shared_ptr<ThreadPool> pool)
+        :mPrefetch(std::make_shared<Prefetch>()), mIndex(0)
+    {
+        mPrefetch->live = std::move(first);
+        mPrefetch->end = std::move(last);
+        mPrefetch->function = std::make_shared<const tUnFunc>(std::move(function));
+        mPrefetch->depth = std::max<std::size_t>(depth, 1);
+        mPrefetch->pool = std::move(pool);
+        mPrefetch->first = 0;
+        mPrefetch->currentIndex = npos;
+    }
+
+    AsyncMapIt(const AsyncMapIt& other, std::size_t index)
+        :mPrefetch(other.mPrefetch), mIndex(index)
+    { }
+
+    AsyncMapIt& operator++()
+    {
+        ++mIndex;
+        return *this;
+    }
+
+    AsyncMapIt operator++(int)
+    {
+        auto tmp = *this;
+        ++mIndex;
+        return tmp;
+    }
+
+    /**
+     * Rethrows exception thrown by function for the element, the walk may continue with the next one
+     */
+    const Result& operator*() const
+    {
+        auto& pre = *mPrefetch;
+        if(pre.currentIndex == mIndex)
+        {
+            if(pre.error)
+                std::rethrow_exception(pre.error);
+            return *pre.current;
+        }
+
+        reach(mIndex);
+        // Future is taken out before get(), so failed element is passed like any other
+        auto result = std::move(pre.pending.front());
+        pre.pending.pop_front();
+        pre.currentIndex = pre.first++;
+        pre.error = nullptr;
+        fill(pre);
+        try
+        {
+            helper::storeResult(pre.current, result.get());
+        }
+        catch(...)
+        {
+            pre.error = std::current_exception();
+            throw;
+        }
+        return *pre.current;
+    }
+
+    const Result* operator->() const
+    {
+        return &(operator*());
+    }
+
+    bool operator==(const AsyncMapIt& other) const
+    {
+        bool atEnd = isAtEnd();
+        bool otherAtEnd = other.isAtEnd();
+        if(atEnd || otherAtEnd)
+            return atEnd == otherAtEnd;
+        return mPrefetch == other.mPrefetch && mIndex == other.mIndex;
+    }
+
+    bool operator!=(const AsyncMapIt& other) const
+    {
+        return !(*this == other);
+    }
+};
+
+namespace helper
+{
+
+/**
+ * SpscQueue is bounded lock-free ring buffer for exactly one producer and one consumer thread
+ * Full queue blocks producer (backpressure), empty one blocks consumer until producer closes it
+ * Waiting thread spins briefly and then sleeps on condition variable, so a stage waiting for slow neighbour
+ * does not burn a core; the other side takes the mutex to notify only when somebody sleeps
+ */
+template<typename T>
+class SpscQueue
+{
+    private:
+    static constexpr int spinCount = 64;
+
+    std::vector<T> mSlots;
+    std::size_t mMask;
+    std::atomic<std::size_t> mHead;
+    std::atomic<std::size_t> mTail;
+    std::atomic<bool> mClosed;
+    std::atomic<bool> mCancelled;
+    std::atomic<int> mSleeping;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+
+    static std::size_t roundUp(std::size_t n)
+    {
+        std::size_t res = 1;
+        while(res < n)
+            res <<= 1;
+        return res;
+    }
+
+    /**
+     * Waits until ready() holds, sleeper is registered before ready() is checked under the mutex
+     * Changes of state, registration of sleeper and loads in wake() and ready() are sequentially consistent,
+     * so either the sleeper sees the change or the waker sees the sleeper
+     */
+    template<typename Ready>
+    void wait(Ready ready)
+    {
+        for(int i = 0; i < spinCount; ++i)
+        {
+            if(ready())
+                return;
+            std::this_thread::yield();
+        }
+        std::unique_lock<std::mutex> lock(mMutex);
+        mSleeping.fetch_add(1);
+        mCondition.wait(lock, ready);
+        mSleeping.fetch_sub(1);
+    }
+
+    void wake()
+    {
+        if(mSleeping.load())
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mCondition.notify_all();
+        }
+    }
+
+    public:
+    explicit SpscQueue(std::size_t capacity)
+        :mSlots(roundUp(std::max<std::size_t>(capacity, 2))), mMask(mSlots.size() - 1),
+          mHead(0), mTail(0), mClosed(false), mCancelled(false), mSleeping(0)
+    { }
+
+    /**
+     * Producer side, returns false if consumer cancelled the queue
+     */
+    bool push(T&& value)
+    {
+        auto tail = mTail.load(std::memory_order_relaxed);
+        wait([this, tail]{
+            return tail - mHead.load() != mSlots.size() || mCancelled.load();
+        });
+        if(tail - mHead.load(std::memory_order_acquire) == mSlots.size())
+            return false;
+        mSlots[tail & mMask] = std::move(value);
+        mTail.store(tail + 1);
+        wake();
+        return true;
+    }
+
+    /**
+     * Consumer side, returns false if queue is closed and empty
+     */
+    bool pop(T& value)
+    {
+        auto head = mHead.load(std::memory_order_relaxed);
+        wait([this, head]{
+            return head != mTail.load() || mClosed.load();
+        });
+        if(head == mTail.load(std::memory_order_acquire))
+            return false;
+        value = std::move(mSlots[head & mMask]);
+        mHead.store(head + 1);
+        wake();
+        return true;
+    }
+
+    /**
+     * Producer side, returns false instead of waiting when the queue is full
+     */
+    bool tryPush(T&& value)
+    {
+        auto tail = mTail.load(std::memory_order_relaxed);
+        if(tail - mHead.load(std::memory_order_acquire) == mSlots.size())
+            return false;
+        mSlots[tail & mMask] = std::move(value);
+        mTail.store(tail + 1);
+        wake();
+        return true;
+    }
+
+    /**
+     * Consumer side, returns false instead of waiting when the queue is empty
+     */
+    bool tryPop(T& value)
+    {
+        auto head = mHead.load(std::memory_order_relaxed);
+        if(head == mTail.load(std::memory_order_acquire))
+            return false;
+        value = std::move(mSlots[head & mMask]);
+        mHead.store(head + 1);
+        wake();
+        return true;
+    }
+
+    void close()
+    {
+        mClosed.store(true);
+        wake();
+    }
+
+    void cancel()
+    {
+        mCancelled.store(true);
+        wake();
+    }
+
+    bool isCancelled() const
+    {
+        return mCancelled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Number of threads parked on the condition variable (not spinning)
+     */
+    int sleeping() const
+    {
+        return mSleeping.load();
+    }
+};
+
+}
+
+/**
+ * StageIt is iterator for stage function
+ * Underlying range is evaluated on its own producer thread which sends elements in batches through
+ * bounded SpscQueue, consumer reads them through this iterator (so it may be used by further lazy stages)
+ * Consumed batches are sent back through another queue, so producer reuses their capacity instead of allocating
+ * Exception thrown by producer is rethrown when consumer reaches it
+ * Range is single-pass, iterator tag is std::input_iterator_tag
+ */
+template<typename Result>
+class StageIt : public std::iterator<std::input_iterator_tag, Result>
+{
+    private:
+    using tBatch = std::vector<Result>;
+
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    struct Channel
+    {
+        helper::SpscQueue<tBatch> queue;
+        // Emptied batches going back to producer, there are at most capacity + 2 batches in flight
+        helper::SpscQueue<tBatch> recycled;
+        std::exception_ptr error;
+        std::thread producer;
+        tBatch batch;
+        std::size_t first;
+        bool finished;
+
+        explicit Channel(std::size_t capacity)
+            :queue(capacity), recycled(capacity + 2), first(0), finished(false)
+        { }
+
+        ~Channel()
+        {
+            // Producer blocked by full queue has to be released before it is joined
+            queue.cancel();
+            if(producer.joinable())
+                producer.join();
+        }
+    };
+
+    std::shared_ptr<Channel> mChannel;
+    std::size_t mIndex;
+
+    bool isAvailable(std::size_t index) const
+    {
+        auto& ch = *mChannel;
+        while(index >= ch.first + ch.batch.size() && !ch.finished)
+        {
+            ch.first += ch.batch.size();
+            ch.batch.clear();
+            if(ch.batch.capacity())
+                ch.recycled.tryPush(std::move(ch.batch));
+            if(!ch.queue.pop(ch.batch))
+            {
+                ch.finished = true;
+                if(ch.error)
+                    std::rethrow_exception(ch.error);
+            }
+        }
+        return index >= ch.first && index < ch.first + ch.batch.size();
+    }
+
+    bool isAtEnd() const
+    {
+        return !mChannel || mIndex == npos || !isAvailable(mIndex);
+    }
+
+    public:
+    StageIt()
+        :mChannel(nullptr), mIndex(npos)
+    { }
+
+    /**
+     * Producer records span (named by name) for evaluation of each batch when tracing is enabled
+     */
+    template<typename Iter>
+    StageIt(Iter first, Iter last, std::size_t batchSize, std::size_t capacity, const char* name = "stage")
+        :mChannel(std::make_shared<Channel>(capacity)), mIndex(0)
+    {
+        auto* ch = mChannel.get();
+        batchSize = std::max<std::size_t>(batchSize, 1);
+        ch->producer = std::thread([ch, first, last, batchSize, name]() mutable {
+            try
+            {
+                tBatch batch;
+                batch.reserve(batchSize);
+                trace::Span span(name, "async", batchSize);
+                for(; first != last && !ch->queue.isCancelled(); ++first)
+                {
+                    batch.push_back(*first);
+                    if(batch.size() == batchSize)
+                    {
+                        span.finish();
+                        if(!ch->queue.push(std::move(batch)))
+                            break;
+                        if(!ch->recycled.tryPop(batch))
+                            batch = tBatch();
+                        batch.reserve(batchSize);
+                        span.start(batchSize);
+                    }
+                }
+                span.setElements(batch.size());
+                span.finish();
+                if(!batch.empty())
+                    ch->queue.push(std::move(batch));
+            }
+            catch(...)
+            {
+                ch->error = std::current_exception();
+            }
+            ch->queue.close();
+        });
+    }
+
+    StageIt(const StageIt& other, std::size_t index)
+        :mChannel(other.mChannel), mIndex(index)
+    { }
+
+    StageIt& operator++()
+    {
+        ++mIndex;
+        return *this;
+    }
+
+    StageIt operator++(int)
+    {
+        auto tmp = *this;
+        ++mIndex;
+        return tmp;
+    }
+
+    const Result& operator*() const
+    {
+        isAvailable(mIndex);
+        return mChannel->batch[mIndex - mChannel->first];
+    }
+
+    const Result* operator->() const
+    {
+        return &(operator*());
+    }
+
+    bool operator==(const StageIt& other) const
+    {
+        bool atEnd = isAtEnd();
+        bool otherAtEnd = other.isAtEnd();
+        if(atEnd || otherAtEnd)
+            return atEnd == otherAtEnd;
+        return mChannel == other.mChannel && mIndex == other.mIndex;
+    }
+
+    bool operator!=(const StageIt& other) const
+    {
+        return !(*this == other);
+    }
+};
+
+
+/**
+ * FUNCTIONS
+ */
+
+/**
+ * Lazy map computing up to depth elements ahead on given thread pool (f has to be safe to call concurrently)
+ */
+template<typename Iterator, typename UnaryFunction>
+auto async_map(Iterator first, Iterator last, UnaryFunction f, std::size_t depth, std::shared_ptr<ThreadPool> pool)
+{
+    using Result = typename std::decay<decltype(f(*first))>::type;
+
+    AsyncMapIt<Iterator, Result> beginIt(std::move(first), std::move(last), f, depth, std::move(pool));
+    AsyncMapIt<Iterator, Result> endIt(beginIt, static_cast<std::size_t>(-1));
+
+    return Range< AsyncMapIt<Iterator, Result> >(std::move(beginIt), std::move(endIt));
+}
+
+/**
+ * Lazy map computing up to depth elements ahead on its own pool of (at most depth) threads
+ */
+template<typename Iterator, typename UnaryFunction>
+auto async_map(Iterator first, Iterator last, UnaryFunction f, std::size_t depth)
+{
+    auto threads = std::min<std::size_t>(std::max<std::size_t>(depth, 1), std::max(std::thread::hardware_concurrency(), 1u));
+    return async_map(std::move(first), std::move(last), f, depth, std::make_shared<ThreadPool>(threads));
+}
+
+
+/**
+ * Evaluates given range (with all lazy stages producing it) on its own thread, elements are passed
+ * to the returned range in batches of batchSize through queue holding at most capacity batches
+ * Iterators of given range have to stay valid and must not be used by other threads meanwhile
+ */
+template<typename Iterator>
+auto stage(Iterator first, Iterator last, std::size_t batchSize = 256, std::size_t capacity = 16, const char* name = "stage")
+{
+    using Result = typename std::decay<decltype(*first)>::type;
+
+    StageIt<Result> beginIt(std::move(first), std::move(last), batchSize, capacity, name);
+    StageIt<Result> endIt(beginIt, static_cast<std::size_t>(-1));
+
+    return Range< StageIt<Result> >(std::move(beginIt), std::move(endIt));
+}
+
+
+} // namespace lazy
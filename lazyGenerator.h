@@ -0,0 +1,272 @@
+/*
+ * HW01, lazy functional library - coroutine generator
+ * Author: David Kuťák, 433409
+ *
+ * Requires C++20 coroutines
+ */
+#pragma once
+
+#include "lazy.h"
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <new>
+
+namespace lazy
+{
+
+namespace helper
+{
+
+/**
+ * FramePool recycles memory of finished coroutine frames
+ * Frames are sorted to size classes (multiples of granularity), each thread keeps its own free lists,
+ * bigger frames go directly to global operator new
+ */
+class FramePool
+{
+    private:
+    static constexpr std::size_t granularity = 64;
+    static constexpr std::size_t classes = 32;
+    static constexpr std::size_t maxFree = 64;
+
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    struct FreeLists
+    {
+        FreeBlock* heads[classes] = {};
+        std::size_t counts[classes] = {};
+
+        ~FreeLists()
+        {
+            for(auto head : heads)
+                while(head)
+                {
+                    auto next = head->next;
+                    ::operator delete(head);
+                    head = next;
+                }
+        }
+    };
+
+    static FreeLists& lists()
+    {
+        thread_local FreeLists freeLists;
+        return freeLists;
+    }
+
+    static std::size_t sizeClass(std::size_t size)
+    {
+        return (size + granularity - 1) / granularity;
+    }
+
+    public:
+    static void* allocate(std::size_t size)
+    {
+        auto cls = sizeClass(size);
+        if(cls >= classes)
+            return ::operator new(size);
+
+        auto& fl = lists();
+        if(auto block = fl.heads[cls])
+        {
+            fl.heads[cls] = block->next;
+            --fl.counts[cls];
+            return block;
+        }
+        return ::operator new(cls * granularity);
+    }
+
+    static void deallocate(void* ptr, std::size_t size)
+    {
+        auto cls = sizeClass(size);
+        auto& fl = lists();
+        if(cls >= classes || fl.counts[cls] == maxFree)
+        {
+            ::operator delete(ptr);
+            return;
+        }
+        auto block = static_cast<FreeBlock*>(ptr);
+        block->next = fl.heads[cls];
+        fl.heads[cls] = block;
+        ++fl.counts[cls];
+    }
+};
+
+}
+
+/**
+ * generator is coroutine producing values of type T by co_yield
+ * Yielded values are not copied - iterator refers to the yielded object, which lives until the coroutine is resumed
+ * Coroutine frames are allocated from helper::FramePool
+ * Iterators are input ones (all copies share the coroutine), so they can be passed to map, filter, zip and unique
+ */
+template<typename T>
+class generator
+{
+    public:
+    struct promise_type
+    {
+        const T* mValue = nullptr;
+        std::exception_ptr mError;
+
+        generator get_return_object()
+        {
+            return generator(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_always final_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_always yield_value(const T& value) noexcept
+        {
+            mValue = &value;
+            return {};
+        }
+
+        void return_void() noexcept {}
+
+        void unhandled_exception()
+        {
+            mError = std::current_exception();
+        }
+
+        static void* operator new(std::size_t size)
+        {
+            return helper::FramePool::allocate(size);
+        }
+
+        static void operator delete(void* ptr, std::size_t size)
+        {
+            helper::FramePool::deallocate(ptr, size);
+        }
+    };
+
+    using tHandle = std::coroutine_handle<promise_type>;
+
+    class iterator : public std::iterator<std::input_iterator_tag, T, std::ptrdiff_t, const T*, const T&>
+    {
+        private:
+        tHandle mHandle;
+
+        bool isAtEnd() const
+        {
+            return !mHandle || mHandle.done();
+        }
+
+        public:
+        iterator()
+            :mHandle(nullptr)
+        { }
+
+        explicit iterator(tHandle handle)
+            :mHandle(handle)
+        { }
+
+        iterator& operator++()
+        {
+            generator::resume(mHandle);
+            return *this;
+        }
+
+        iterator operator++(int)
+        {
+            auto tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        const T& operator*() const
+        {
+            return *mHandle.promise().mValue;
+        }
+
+        const T* operator->() const
+        {
+            return mHandle.promise().mValue;
+        }
+
+        bool operator==(const iterator& other) const
+        {
+            bool atEnd = isAtEnd();
+            bool otherAtEnd = other.isAtEnd();
+            if(atEnd || otherAtEnd)
+                return atEnd == otherAtEnd;
+            return mHandle == other.mHandle;
+        }
+
+        bool operator!=(const iterator& other) const
+        {
+            return !(*this == other);
+        }
+    };
+
+    private:
+    tHandle mHandle;
+    bool mStarted;
+
+    static void resume(tHandle handle)
+    {
+        handle.resume();
+        if(handle.done() && handle.promise().mError)
+            std::rethrow_exception(handle.promise().mError);
+    }
+
+    explicit generator(tHandle handle)
+        :mHandle(handle), mStarted(false)
+    { }
+
+    public:
+    generator(generator&& other) noexcept
+        :mHandle(other.mHandle), mStarted(other.mStarted)
+    {
+        other.mHandle = nullptr;
+    }
+
+    generator& operator=(generator other) noexcept
+    {
+        std::swap(mHandle, other.mHandle);
+        std::swap(mStarted, other.mStarted);
+        return *this;
+    }
+
+    generator(const generator&) = delete;
+
+    /**
+     * Starts the coroutine (only the first call, generator is single-pass)
+     */
+    iterator begin()
+    {
+        if(mHandle && !mStarted)
+        {
+            mStarted = true;
+            resume(mHandle);
+        }
+        return iterator(mHandle);
+    }
+
+    iterator end()
+    {
+        return iterator();
+    }
+
+    ~generator()
+    {
+        if(mHandle)
+            mHandle.destroy();
+    }
+};
+
+
+} // namespace lazy
@@ -0,0 +1,201 @@
+/*
+ * HW01, lazy functional library - latency histograms
+ * Author: David Kuťák, 433409
+ *
+ * Sampled durations of functions of map/filter/zip/unique stages in log-bucketed histogram
+ */
+#pragma once
+
+#include "lazy.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace lazy
+{
+
+/**
+ * LatencyHistogram records durations (in nanoseconds) with bounded relative error
+ * Values below 16 have own buckets, every further power of two is split to 16 buckets (HDR-style),
+ * so value reported for a percentile is at most 1/16 above the recorded one
+ * Counters are atomic, histogram may be shared by stages running on different threads
+ */
+class LatencyHistogram
+{
+    private:
+    static constexpr std::size_t subBits = 4;
+    static constexpr std::size_t subBuckets = 1 << subBits;
+    static constexpr std::size_t bucketCount = (64 - subBits + 1) * subBuckets;
+
+    std::atomic<std::uint64_t> mBuckets[bucketCount];
+    std::atomic<std::uint64_t> mCount;
+    std::atomic<std::uint64_t> mSum;
+    std::atomic<std::uint64_t> mMin;
+    std::atomic<std::uint64_t> mMax;
+
+    static std::size_t highestBit(std::uint64_t value)
+    {
+        std::size_t bit = 0;
+        while(value >>= 1)
+            ++bit;
+        return bit;
+    }
+
+    public:
+    LatencyHistogram()
+    {
+        reset();
+    }
+
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    static std::size_t bucketIndex(std::uint64_t value)
+    {
+        if(value < subBuckets)
+            return static_cast<std::size_t>(value);
+        auto bit = highestBit(value);
+        return (bit - subBits + 1) * subBuckets + static_cast<std::size_t>((value >> (bit - subBits)) - subBuckets);
+    }
+
+    /**
+     * Highest value falling into the bucket
+     */
+    static std::uint64_t bucketUpper(std::size_t index)
+    {
+        if(index < subBuckets)
+            return index;
+        auto shift = index / subBuckets - 1;
+        auto mantissa = static_cast<std::uint64_t>(index % subBuckets + subBuckets);
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+    void record(std::uint64_t nanoseconds)
+    {
+        mBuckets[bucketIndex(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+        mCount.fetch_add(1, std::memory_order_relaxed);
+        mSum.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+        auto min = mMin.load(std::memory_order_relaxed);
+        while(nanoseconds < min && !mMin.compare_exchange_weak(min, nanoseconds, std::memory_order_relaxed));
+        auto max = mMax.load(std::memory_order_relaxed);
+        while(nanoseconds > max && !mMax.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed));
+    }
+
+    std::uint64_t count() const
+    {
+        return mCount.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t min() const
+    {
+        return count() ? mMin.load(std::memory_order_relaxed) : 0;
+    }
+
+    std::uint64_t max() const
+    {
+        return mMax.load(std::memory_order_relaxed);
+    }
+
+    double mean() const
+    {
+        auto n = count();
+        return n ? static_cast<double>(mSum.load(std::memory_order_relaxed)) / n : 0;
+    }
+
+    /**
+     * Smallest recorded duration (up to bucket precision) not exceeded by given percent of samples, e.g. percentile(99)
+     */
+    std::uint64_t percentile(double percent) const
+    {
+        auto n = count();
+        if(!n)
+            return 0;
+        percent = std::min(std::max(percent, 0.0), 100.0);
+        auto rank = static_cast<std::uint64_t>(percent / 100.0 * n + 0.5);
+        rank = std::min(std::max<std::uint64_t>(rank, 1), n);
+
+        std::uint64_t seen = 0;
+        for(std::size_t i = 0; i < bucketCount; ++i)
+        {
+            seen += mBuckets[i].load(std::memory_order_relaxed);
+            if(seen >= rank)
+                return std::min(bucketUpper(i), max());
+        }
+        return max();
+    }
+
+    /**
+     * Has to be called when no stage records
+     */
+    void reset()
+    {
+        for(auto& bucket : mBuckets)
+            bucket.store(0, std::memory_order_relaxed);
+        mCount.store(0, std::memory_order_relaxed);
+        mSum.store(0, std::memory_order_relaxed);
+        mMin.store(UINT64_MAX, std::memory_order_relaxed);
+        mMax.store(0, std::memory_order_relaxed);
+    }
+};
+
+/**
+ * Statistics policy of MapIt, FilterIt, ZipIt and unique which records duration of every n-th call
+ * of function/predicate into LatencyHistogram owned by caller, e.g. lazy::filter(first, last, p, lazy::Sampled(hist, 100))
+ * Each copy of iterator samples its own calls, the first call is always sampled
+ * Default constructed policy has no histogram and times nothing (default Stats argument of stages)
+ */
+class Sampled
+{
+    private:
+    LatencyHistogram* mHistogram;
+    std::size_t mEvery;
+    std::size_t mCalls;
+
+    class Timer
+    {
+        private:
+        LatencyHistogram& mHistogram;
+        std::chrono::steady_clock::time_point mStart;
+
+        public:
+        explicit Timer(LatencyHistogram& histogram)
+            :mHistogram(histogram), mStart(std::chrono::steady_clock::now())
+        { }
+
+        ~Timer()
+        {
+            auto elapsed = std::chrono::steady_clock::now() - mStart;
+            mHistogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+        }
+    };
+
+    public:
+    // Only durations are recorded, counters of unique are not needed
+    static constexpr bool enabled = false;
+
+    Sampled()
+        :mHistogram(nullptr), mEvery(1), mCalls(0)
+    { }
+
+    explicit Sampled(LatencyHistogram& histogram, std::size_t every = 1)
+        :mHistogram(&histogram), mEvery(std::max<std::size_t>(every, 1)), mCalls(0)
+    { }
+
+    void onPull() {}
+    void onYield() {}
+    void onCacheHit() {}
+    void onUnique(std::size_t, std::size_t) {}
+
+    template<typename F>
+    decltype(auto) onCall(F&& f)
+    {
+        if(!mHistogram || mCalls++ % mEvery)
+            return f();
+        Timer timer(*mHistogram);
+        return f();
+    }
+};
+
+} // namespace lazy
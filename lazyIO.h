@@ -0,0 +1,1457 @@
+/*
+ * HW01, lazy functional library - file sources and sinks
+ * Author: David Kuťák, 433409
+ *
+ * Requires C++17 and POSIX (mmap), asynchronous sources need threads library (-pthread)
+ */
+#pragma once
+
+#include "lazy.h"
+
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace lazy
+{
+
+/**
+ * MappedFile maps whole file to memory (read only)
+ * Errors are reported by std::system_error
+ */
+class MappedFile
+{
+    private:
+    const char* mData;
+    std::size_t mSize;
+
+    void unmap()
+    {
+        if(mData)
+            ::munmap(const_cast<char*>(mData), mSize);
+        mData = nullptr;
+        mSize = 0;
+    }
+
+    public:
+    /**
+     * sequential = hint for kernel to read ahead aggressively and drop pages behind (madvise)
+     */
+    explicit MappedFile(const std::string& path, bool sequential = true)
+        :mData(nullptr), mSize(0)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0)
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+
+        struct stat info;
+        if(::fstat(fd, &info) != 0)
+        {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "fstat " + path);
+        }
+
+        mSize = static_cast<std::size_t>(info.st_size);
+        if(mSize != 0)
+        {
+            void* addr = ::mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(addr == MAP_FAILED)
+            {
+                int err = errno;
+                ::close(fd);
+                throw std::system_error(err, std::generic_category(), "mmap " + path);
+            }
+            mData = static_cast<const char*>(addr);
+            if(sequential)
+                ::madvise(addr, mSize, MADV_SEQUENTIAL);
+        }
+        ::close(fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept
+        :mData(other.mData), mSize(other.mSize)
+    {
+        other.mData = nullptr;
+        other.mSize = 0;
+    }
+
+    MappedFile& operator=(MappedFile&& other) noexcept
+    {
+        std::swap(mData, other.mData);
+        std::swap(mSize, other.mSize);
+        return *this;
+    }
+
+    const char* data() const
+    {
+        return mData;
+    }
+
+    std::size_t size() const
+    {
+        return mSize;
+    }
+
+    std::string_view view() const
+    {
+        return std::string_view(mData, mSize);
+    }
+
+    ~MappedFile()
+    {
+        unmap();
+    }
+};
+
+/**
+ * LineIt is iterator over lines of text in memory, lines are std::string_view pointing to the text (without '\n')
+ * Line ends are searched by memchr, which is vectorized by standard library
+ * Iterator tag is std::forward_iterator_tag
+ */
+class LineIt : public std::iterator<std::forward_iterator_tag, std::string_view, std::ptrdiff_t, const std::string_view*, const std::string_view&>
+{
+    private:
+    const char* mPos;
+    const char* mEnd;
+    std::string_view mLine;
+
+    void findLine()
+    {
+        if(mPos == mEnd)
+        {
+            mLine = std::string_view();
+            return;
+        }
+        auto lineEnd = static_cast<const char*>(std::memchr(mPos, '\n', static_cast<std::size_t>(mEnd - mPos)));
+        mLine = std::string_view(mPos, static_cast<std::size_t>((lineEnd ? lineEnd : mEnd) - mPos));
+    }
+
+    public:
+    LineIt()
+        :mPos(nullptr), mEnd(nullptr)
+    { }
+
+    LineIt(const char* pos, const char* end)
+        :mPos(pos), mEnd(end)
+    {
+        findLine();
+    }
+
+    LineIt& operator++()
+    {
+        mPos += mLine.size();
+        if(mPos != mEnd)
+            ++mPos;
+        findLine();
+        return *this;
+    }
+
+    LineIt operator++(int)
+    {
+        auto tmp = *this;
+        ++*this;
+        return tmp;
+    }
+
+    const std::string_view& operator*() const
+    {
+        return mLine;
+    }
+
+    const std::string_view* operator->() const
+    {
+        return &mLine;
+    }
+
+    bool operator==(const LineIt& other) const
+    {
+        return mPos == other.mPos;
+    }
+
+    bool operator!=(const LineIt& other) const
+    {
+        return !(*this == other);
+    }
+};
+
+
+/**
+ * RecordFile maps file containing flat array of trivially copyable records
+ * begin() & end() are pointers to the mapping, so it is random access range of const Record&
+ * Incomplete record at the end of file is ignored
+ */
+template<typename Record>
+class RecordFile
+{
+    static_assert(std::is_trivially_copyable<Record>::value, "records have to be trivially copyable");
+
+    private:
+    MappedFile mFile;
+
+    public:
+    explicit RecordFile(const std::string& path, bool sequential = true)
+        :mFile(path, sequential)
+    { }
+
+    const Record* begin() const
+    {
+        return reinterpret_cast<const Record*>(mFile.data());
+    }
+
+    const Record* end() const
+    {
+        return begin() + size();
+    }
+
+    std::size_t size() const
+    {
+        return mFile.size() / sizeof(Record);
+    }
+
+    const Record& operator[](std::size_t index) const
+    {
+        return begin()[index];
+    }
+};
+
+/**
+ * WindowRecordIt is iterator for WindowedRecordFile
+ * Only window of the file around current record is mapped, the window slides (is remapped) as iterator advances,
+ * so address space used by scan is bounded by window size
+ * Reference to record is valid only until any iterator of the file moves to another window,
+ * so iterator tag is std::input_iterator_tag
+ */
+template<typename Record>
+class WindowRecordIt : public std::iterator<std::input_iterator_tag, Record, std::ptrdiff_t, const Record*, const Record&>
+{
+    public:
+    struct Window
+    {
+        int fd = -1;
+        std::size_t fileSize = 0;
+        std::size_t windowSize = 0;
+        const char* data = nullptr;
+        std::size_t offset = 0;
+        std::size_t length = 0;
+
+        Window() = default;
+        Window(const Window&) = delete;
+        Window& operator=(const Window&) = delete;
+
+        void unmap()
+        {
+            if(data)
+                ::munmap(const_cast<char*>(data), length);
+            data = nullptr;
+        }
+
+        /**
+         * Maps window starting at page containing given byte and containing record starting there
+         */
+        const Record& at(std::size_t index)
+        {
+            std::size_t byte = index * sizeof(Record);
+            if(!data || byte < offset || byte + sizeof(Record) > offset + length)
+            {
+                unmap();
+                static const std::size_t page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+                offset = byte - byte % page;
+                length = std::min(std::max(windowSize, byte - offset + sizeof(Record)), fileSize - offset);
+                void* addr = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(offset));
+                if(addr == MAP_FAILED)
+                    throw std::system_error(errno, std::generic_category(), "mmap window");
+                ::madvise(addr, length, MADV_SEQUENTIAL);
+                data = static_cast<const char*>(addr);
+            }
+            return *reinterpret_cast<const Record*>(data + (byte - offset));
+        }
+
+        ~Window()
+        {
+            unmap();
+            if(fd >= 0)
+                ::close(fd);
+        }
+    };
+
+    private:
+    std::shared_ptr<Window> mWindow;
+    std::size_t mIndex;
+
+    public:
+    WindowRecordIt()
+        :mWindow(nullptr), mIndex(0)
+    { }
+
+    WindowRecordIt(std::shared_ptr<Window> window, std::size_t index)
+        :mWindow(std::move(window)), mIndex(index)
+    { }
+
+    WindowRecordIt& operator++()
+    {
+        ++mIndex;
+        return *this;
+    }
+
+    WindowRecordIt operator++(int)
+    {
+        auto tmp = *this;
+        ++mIndex;
+        return tmp;
+    }
+
+    const Record& operator*() const
+    {
+        return mWindow->at(mIndex);
+    }
+
+    const Record* operator->() const
+    {
+        return &(operator*());
+    }
+
+    bool operator==(const WindowRecordIt& other) const
+    {
+        return mIndex == other.mIndex;
+    }
+
+    bool operator!=(const WindowRecordIt& other) const
+    {
+        return !(*this == other);
+    }
+};
+
+/**
+ * WindowedRecordFile is RecordFile for files too big to be mapped at once
+ * windowSize = number of bytes mapped at a time (rounded to pages by the system)
+ */
+template<typename Record>
+class WindowedRecordFile
+{
+    static_assert(std::is_trivially_copyable<Record>::value, "records have to be trivially copyable");
+
+    private:
+    using tWindow = typename WindowRecordIt<Record>::Window;
+
+    std::shared_ptr<tWindow> mWindow;
+
+    public:
+    WindowedRecordFile(const std::string& path, std::size_t windowSize = 64 << 20)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0)
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+
+        struct stat info;
+        if(::fstat(fd, &info) != 0)
+        {
+            int err = errno;
+            ::close(fd);
+            throw std::system_error(err, std::generic_category(), "fstat " + path);
+        }
+        mWindow = std::make_shared<tWindow>();
+        mWindow->fd = fd;
+        mWindow->fileSize = static_cast<std::size_t>(info.st_size);
+        mWindow->windowSize = std::max(windowSize, sizeof(Record));
+    }
+
+    WindowRecordIt<Record> begin() const
+    {
+        return WindowRecordIt<Record>(mWindow, 0);
+    }
+
+    WindowRecordIt<Record> end() const
+    {
+        return WindowRecordIt<Record>(mWindow, size());
+    }
+
+    std::size_t size() const
+    {
+        return mWindow->fileSize / sizeof(Record);
+    }
+
+    /**
+     * Bytes currently mapped
+     */
+    std::size_t mapped() const
+    {
+        return mWindow->data ? mWindow->length : 0;
+    }
+};
+
+
+/**
+ * Options of CSV reader
+ * columns = projection, only these columns (in given order) are stored in rows, all columns if empty
+ * bufferSize = size of read buffer used when reading file (it grows only if one row does not fit)
+ */
+struct CsvOptions
+{
+    char delimiter = ',';
+    bool header = false;
+    std::vector<std::size_t> columns;
+    std::size_t bufferSize = 1 << 20;
+};
+
+/**
+ * CsvRow is one row of CSV, fields are std::string_view pointing to reader's buffer
+ * Quotes around field are stripped, doubled quotes inside quoted field are unescaped into reader's scratch
+ * buffer (reused for all rows), other fields point directly to the data
+ */
+class CsvRow
+{
+    private:
+    std::vector<std::string_view> mFields;
+
+    public:
+    std::size_t size() const
+    {
+        return mFields.size();
+    }
+
+    std::string_view operator[](std::size_t index) const
+    {
+        return mFields[index];
+    }
+
+    /**
+     * Parses field as number (std::from_chars), throws std::invalid_argument if it is not a number
+     */
+    template<typename T>
+    T as(std::size_t index) const
+    {
+        auto field = mFields[index];
+        T value{};
+        auto res = std::from_chars(field.data(), field.data() + field.size(), value);
+        if(res.ec != std::errc() || res.ptr != field.data() + field.size())
+            throw std::invalid_argument("csv field is not a number: " + std::string(field));
+        return value;
+    }
+
+    std::vector<std::string_view>& fields()
+    {
+        return mFields;
+    }
+};
+
+/**
+ * CsvIt is iterator over rows of CSV text (in memory or streamed from file)
+ * File is read in big blocks into one reused buffer, rows are split in place and only projected columns are stored,
+ * so there is no allocation per field or row
+ * Row is valid until iterator is incremented, iterator tag is std::input_iterator_tag
+ * Quoted field not closed before the end of data is reported by std::runtime_error
+ */
+class CsvIt : public std::iterator<std::input_iterator_tag, CsvRow, std::ptrdiff_t, const CsvRow*, const CsvRow&>
+{
+    private:
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    struct Reader
+    {
+        CsvOptions options;
+        std::vector<int> slots;
+        std::vector<char> buffer;
+        const char* data = nullptr;
+        const char* pos = nullptr;
+        const char* end = nullptr;
+        int fd = -1;
+        bool eof = true;
+        CsvRow row;
+        // Unescaped quoted fields of current row
+        std::string scratch;
+        std::size_t rowIndex = npos;
+        bool finished = false;
+
+        Reader() = default;
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        ~Reader()
+        {
+            if(fd >= 0)
+                ::close(fd);
+        }
+
+        /**
+         * Keeps unprocessed data and reads next block after them, returns false at the end of file
+         */
+        bool refill()
+        {
+            if(eof)
+                return false;
+            std::size_t kept = static_cast<std::size_t>(end - pos);
+            // Kept bytes are moved before growing, resize may reallocate the buffer pos points to
+            std::memmove(buffer.data(), pos, kept);
+            if(kept == buffer.size())
+                buffer.resize(buffer.size() * 2);
+            auto got = ::read(fd, buffer.data() + kept, buffer.size() - kept);
+            if(got < 0)
+                throw std::system_error(errno, std::generic_category(), "read csv");
+            eof = got == 0;
+            data = buffer.data();
+            pos = data;
+            end = data + kept + got;
+            return true;
+        }
+
+        /**
+         * End of row starting at pos (newline outside of quotes), nullptr if row is not complete in buffer
+         */
+        const char* findRowEnd() const
+        {
+            bool quoted = false;
+            for(const char* from = pos; ; )
+            {
+                auto nl = static_cast<const char*>(std::memchr(from, '\n', static_cast<std::size_t>(end - from)));
+                auto stop = nl ? nl : end;
+                if(std::count(from, stop, '"') % 2 != 0)
+                    quoted = !quoted;
+                if(!quoted && nl)
+                    return nl;
+                if(!nl)
+                    return eof && !quoted ? end : nullptr;
+                from = nl + 1;
+            }
+        }
+
+        void splitRow(const char* first, const char* last)
+        {
+            if(last != first && *(last - 1) == '\r')
+                --last;
+
+            auto& fields = row.fields();
+            fields.assign(slots.empty() ? 0 : options.columns.size(), std::string_view());
+            // Unescaped fields are never longer than the row, so the scratch does not reallocate under views into it
+            scratch.clear();
+            std::size_t column = 0;
+            const char* p = first;
+            while(true)
+            {
+                const char* fieldBeg = p;
+                const char* fieldEnd;
+                bool escaped = false;
+                if(p != last && *p == '"')
+                {
+                    ++fieldBeg;
+                    ++p;
+                    while(p != last && !(*p == '"' && (p + 1 == last || *(p + 1) != '"')))
+                    {
+                        escaped |= *p == '"';
+                        p += (*p == '"') ? 2 : 1;
+                    }
+                    fieldEnd = p;
+                    if(p != last)
+                        ++p;
+                    p = std::find(p, last, options.delimiter);
+                }
+                else
+                {
+                    p = std::find(p, last, options.delimiter);
+                    fieldEnd = p;
+                }
+
+                std::string_view field(fieldBeg, static_cast<std::size_t>(fieldEnd - fieldBeg));
+                if(escaped && (slots.empty() || (column < slots.size() && slots[column] >= 0)))
+                {
+                    if(scratch.capacity() < static_cast<std::size_t>(last - first))
+                        scratch.reserve(static_cast<std::size_t>(last - first));
+                    auto start = scratch.size();
+                    for(const char* c = fieldBeg; c != fieldEnd; ++c)
+                    {
+                        scratch.push_back(*c);
+                        if(*c == '"')
+                            ++c;
+                    }
+                    field = std::string_view(scratch.data() + start, scratch.size() - start);
+                }
+                if(slots.empty())
+                    fields.push_back(field);
+                else if(column < slots.size() && slots[column] >= 0)
+                    fields[static_cast<std::size_t>(slots[column])] = field;
+
+                ++column;
+                if(p == last)
+                    break;
+                ++p;
+            }
+        }
+
+        /**
+         * Parses next row, returns false at the end of data
+         * Throws std::runtime_error when data end inside quoted field
+         */
+        bool nextRow()
+        {
+            while(true)
+            {
+                if(pos == end && !refill())
+                    return false;
+                if(pos == end)
+                    continue;
+                if(auto rowEnd = findRowEnd())
+                {
+                    splitRow(pos, rowEnd);
+                    pos = rowEnd == end ? end : rowEnd + 1;
+                    return true;
+                }
+                if(!refill())
+                    throw std::runtime_error("csv ends inside quoted field");
+            }
+        }
+
+        bool reach(std::size_t index)
+        {
+            while((rowIndex == npos || rowIndex < index) && !finished)
+            {
+                if(nextRow())
+                    rowIndex = rowIndex == npos ? 0 : rowIndex + 1;
+                else
+                    finished = true;
+            }
+            return rowIndex == index;
+        }
+
+        void start()
+        {
+            slots.clear();
+            for(std::size_t i = 0; i < options.columns.size(); ++i)
+            {
+                if(options.columns[i] >= slots.size())
+                    slots.resize(options.columns[i] + 1, -1);
+                slots[options.columns[i]] = static_cast<int>(i);
+            }
+            if(options.header)
+                nextRow();
+        }
+    };
+
+    std::shared_ptr<Reader> mReader;
+    std::size_t mIndex;
+
+    bool isAtEnd() const
+    {
+        return !mReader || mIndex == npos || !mReader->reach(mIndex);
+    }
+
+    public:
+    CsvIt()
+        :mReader(nullptr), mIndex(npos)
+    { }
+
+    /**
+     * Rows of text in memory (text has to outlive the range)
+     */
+    CsvIt(std::string_view text, CsvOptions options)
+        :mReader(std::make_shared<Reader>()), mIndex(0)
+    {
+        mReader->options = std::move(options);
+        mReader->data = text.data();
+        mReader->pos = text.data();
+        mReader->end = text.data() + text.size();
+        mReader->start();
+    }
+
+    /**
+     * Rows streamed from file
+     */
+    CsvIt(const std::string& path, CsvOptions options)
+        :mReader(std::make_shared<Reader>()), mIndex(0)
+    {
+        auto& reader = *mReader;
+        reader.fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(reader.fd < 0)
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+        reader.buffer.resize(std::max<std::size_t>(options.bufferSize, 64));
+        reader.options = std::move(options);
+        reader.eof = false;
+        reader.data = reader.pos = reader.end = reader.buffer.data();
+        reader.start();
+    }
+
+    CsvIt(const CsvIt& other, std::size_t index)
+        :mReader(other.mReader), mIndex(index)
+    { }
+
+    CsvIt& operator++()
+    {
+        ++mIndex;
+        return *this;
+    }
+
+    CsvIt operator++(int)
+    {
+        auto tmp = *this;
+        ++mIndex;
+        return tmp;
+    }
+
+    const CsvRow& operator*() const
+    {
+        mReader->reach(mIndex);
+        return mReader->row;
+    }
+
+    const CsvRow* operator->() const
+    {
+        return &(operator*());
+    }
+
+    bool operator==(const CsvIt& other) const
+    {
+        bool atEnd = isAtEnd();
+        bool otherAtEnd = other.isAtEnd();
+        if(atEnd || otherAtEnd)
+            return atEnd == otherAtEnd;
+        return mReader == other.mReader && mIndex == other.mIndex;
+    }
+
+    bool operator!=(const CsvIt& other) const
+    {
+        return !(*this == other);
+    }
+};
+
+
+namespace helper
+{
+
+/**
+ * BlockReader reads file on background thread into ring of buffers (two of them = double buffering)
+ * Consumer holds one block at a time, the reader fills the other buffers meanwhile and waits when all of them are full
+ * Uses only plain read(2), so it works on any filesystem
+ */
+class BlockReader
+{
+    private:
+    int mFd;
+    std::size_t mBlockSize;
+    std::vector<std::vector<char>> mBuffers;
+    std::vector<std::size_t> mSizes;
+    std::size_t mProduced;
+    std::size_t mConsumed;
+    bool mEof;
+    bool mStop;
+    std::exception_ptr mError;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::thread mProducer;
+
+    std::size_t readBlock(std::vector<char>& buffer)
+    {
+        std::size_t filled = 0;
+        while(filled < buffer.size())
+        {
+            auto got = ::read(mFd, buffer.data() + filled, buffer.size() - filled);
+            if(got < 0 && errno == EINTR)
+                continue;
+            if(got < 0)
+                throw std::system_error(errno, std::generic_category(), "read");
+            if(got == 0)
+                break;
+            filled += static_cast<std::size_t>(got);
+        }
+        return filled;
+    }
+
+    void produce()
+    {
+        try
+        {
+            while(true)
+            {
+                std::size_t slot;
+                {
+                    std::unique_lock<std::mutex> lock(mMutex);
+                    mCondition.wait(lock, [this]{return mStop || mProduced - mConsumed < mBuffers.size();});
+                    if(mStop)
+                        return;
+                    slot = mProduced % mBuffers.size();
+                }
+
+                auto size = readBlock(mBuffers[slot]);
+
+                std::lock_guard<std::mutex> lock(mMutex);
+                mSizes[slot] = size;
+                if(size != 0)
+                    ++mProduced;
+                if(size < mBlockSize)
+                {
+                    mEof = true;
+                    mCondition.notify_all();
+                    return;
+                }
+                mCondition.notify_all();
+            }
+        }
+        catch(...)
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mError = std::current_exception();
+            mEof = true;
+            mCondition.notify_all();
+        }
+    }
+
+    public:
+    BlockReader(const std::string& path, std::size_t blockSize, std::size_t buffers)
+        :mFd(::open(path.c_str(), O_RDONLY | O_CLOEXEC)), mBlockSize(std::max<std::size_t>(blockSize, 1)),
+          mBuffers(std::max<std::size_t>(buffers, 1), std::vector<char>(mBlockSize)), mSizes(mBuffers.size(), 0),
+          mProduced(0), mConsumed(0), mEof(false), mStop(false)
+    {
+        if(mFd < 0)
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+        ::posix_fadvise(mFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        mProducer = std::thread([this]{produce();});
+    }
+
+    BlockReader(const BlockReader&) = delete;
+    BlockReader& operator=(const BlockReader&) = delete;
+
+    /**
+     * Waits for block with given index, blocks before it are released for reuse
+     * Returns false if file has less blocks
+     */
+    bool acquire(std::size_t index, std::string_view& block)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        if(index > mConsumed)
+        {
+            mConsumed = index;
+            mCondition.notify_all();
+        }
+        mCondition.wait(lock, [this, index]{return mProduced > index || mEof;});
+        if(mProduced <= index)
+        {
+            if(mError)
+                std::rethrow_exception(mError);
+            return false;
+        }
+        auto slot = index % mBuffers.size();
+        block = std::string_view(mBuffers[slot].data(), mSizes[slot]);
+        return true;
+    }
+
+    ~BlockReader()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+        }
+        mCondition.notify_all();
+        mProducer.join();
+        ::close(mFd);
+    }
+};
+
+/**
+ * FileSink collects output in big buffer and writes it to file by few large write(2) calls
+ * Buffers are allocated (and initialized) once, then only the write position moves, so reserve does not touch memory
+ * In asynchronous mode full buffer is handed over to one writer thread (living as long as the sink)
+ * and written while the next one is being filled
+ */
+class FileSink
+{
+    private:
+    int mFd;
+    std::size_t mBufferSize;
+    bool mAsync;
+    std::vector<char> mBuffer;
+    std::size_t mSize;
+    std::vector<char> mSpare;
+    std::size_t mSpareSize;
+    std::thread mWriter;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    bool mPending;
+    bool mStop;
+    std::exception_ptr mError;
+
+    static void writeAll(int fd, const char* data, std::size_t size)
+    {
+        while(size != 0)
+        {
+            auto written = ::write(fd, data, size);
+            if(written < 0 && errno == EINTR)
+                continue;
+            if(written < 0)
+                throw std::system_error(errno, std::generic_category(), "write");
+            data += written;
+            size -= static_cast<std::size_t>(written);
+        }
+    }
+
+    /**
+     * Writer thread writes spare buffer whenever it is handed over, pending buffer is written before stopping
+     */
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        while(true)
+        {
+            mCondition.wait(lock, [this]{return mPending || mStop;});
+            if(!mPending)
+                return;
+            lock.unlock();
+            try
+            {
+                writeAll(mFd, mSpare.data(), mSpareSize);
+            }
+            catch(...)
+            {
+                lock.lock();
+                mError = std::current_exception();
+                lock.unlock();
+            }
+            lock.lock();
+            mPending = false;
+            mCondition.notify_all();
+        }
+    }
+
+    /**
+     * Waits until spare buffer is written, rethrows error of the write
+     */
+    void wait()
+    {
+        if(!mAsync)
+            return;
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCondition.wait(lock, [this]{return !mPending;});
+        if(mError)
+        {
+            auto error = mError;
+            mError = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    void stop()
+    {
+        if(!mWriter.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+        }
+        mCondition.notify_all();
+        mWriter.join();
+    }
+
+    public:
+    FileSink(const std::string& path, std::size_t bufferSize, bool async)
+        :mFd(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)),
+          mBufferSize(std::max<std::size_t>(bufferSize, 64)), mAsync(async), mSize(0), mSpareSize(0), mPending(false), mStop(false)
+    {
+        if(mFd < 0)
+            throw std::system_error(errno, std::generic_category(), "open " + path);
+        mBuffer.resize(mBufferSize);
+        if(mAsync)
+        {
+            mSpare.resize(mBufferSize);
+            mWriter = std::thread([this]{work();});
+        }
+    }
+
+    FileSink(const FileSink&) = delete;
+    FileSink& operator=(const FileSink&) = delete;
+
+    /**
+     * Space for at most n bytes at the end of buffer, buffer is flushed first if there is not enough room
+     */
+    char* reserve(std::size_t n)
+    {
+        if(mSize + n > mBufferSize)
+            flush();
+        auto out = mBuffer.data() + mSize;
+        mSize += n;
+        return out;
+    }
+
+    /**
+     * Returns unused part of space obtained by reserve
+     */
+    void commit(char* end)
+    {
+        mSize = static_cast<std::size_t>(end - mBuffer.data());
+    }
+
+    void append(const char* data, std::size_t size)
+    {
+        if(size > mBufferSize)
+        {
+            flush();
+            wait();
+            writeAll(mFd, data, size);
+            return;
+        }
+        std::memcpy(reserve(size), data, size);
+    }
+
+    void flush()
+    {
+        if(mSize == 0)
+            return;
+        if(!mAsync)
+        {
+            writeAll(mFd, mBuffer.data(), mSize);
+            mSize = 0;
+            return;
+        }
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            std::swap(mBuffer, mSpare);
+            mSpareSize = mSize;
+            mPending = true;
+        }
+        mCondition.notify_all();
+        mSize = 0;
+    }
+
+    /**
+     * Writes rest of data and reports errors of background writes
+     */
+    void close()
+    {
+        flush();
+        wait();
+        stop();
+        if(mFd >= 0 && ::close(mFd) != 0)
+        {
+            mFd = -1;
+            throw std::system_error(errno, std::generic_category(), "close");
+        }
+        mFd = -1;
+    }
+
+    ~FileSink()
+    {
+        stop();
+        if(mFd >= 0)
+            ::close(mFd);
+    }
+};
+
+/**
+ * Appends text form of value to sink - numbers by std::to_chars, strings as they are, anything else by operator<<
+ */
+template<typename T>
+typename std::enable_if<std::is_arithmetic<T>::value && !std::is_same<T, bool>::value && !std::is_same<T, char>::value>::type
+appendText(FileSink& sink, const T& value)
+{
+    constexpr std::size_t maxChars = 64;
+    char* out = sink.reserve(maxChars);
+    sink.commit(std::to_chars(out, out + maxChars, value).ptr);
+}
+
+inline void appendText(FileSink& sink, char value)
+{
+    sink.append(&value, 1);
+}
+
+inline void appendText(FileSink& sink, bool value)
+{
+    sink.append(value ? "1" : "0", 1);
+}
+
+inline void appendText(FileSink& sink, std::string_view value)
+{
+    sink.append(value.data(), value.size());
+}
+
+inline void appendText(FileSink& sink, const std::string& value)
+{
+    sink.append(value.data(), value.size());
+}
+
+inline void appendText(FileSink& sink, const char* value)
+{
+    appendText(sink, std::string_view(value));
+}
+
+template<typename T>
+typename std::enable_if<!std::is_arithmetic<T>::value && !std::is_convertible<const T&, std::string_view>::value>::type
+appendText(FileSink& sink, const T& value)
+{
+    std::ostringstream str;
+    str << value;
+    appendText(sink, str.str());
+}
+
+}
+
+/**
+ * Options of sinks
+ * bufferSize = size of output buffer, async = write full buffers on background thread
+ */
+struct SinkOptions
+{
+    std::size_t bufferSize = 1 << 20;
+    bool async = false;
+};
+
+/**
+ * BlockIt is iterator over blocks of file read by helper::BlockReader, block is std::string_view into reader's buffer
+ * Block is valid until iterator moves to the next one, iterator tag is std::input_iterator_tag
+ */
+class BlockIt : public std::iterator<std::input_iterator_tag, std::string_view, std::ptrdiff_t, const std::string_view*, const std::string_view&>
+{
+    private:
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    struct Blocks
+    {
+        helper::BlockReader reader;
+        std::string_view block;
+        std::size_t blockIndex;
+
+        Blocks(const std::string& path, std::size_t blockSize, std::size_t buffers)
+            :reader(path, blockSize, buffers), blockIndex(npos)
+        { }
+
+        bool reach(std::size_t index)
+        {
+            if(blockIndex == index)
+                return true;
+            if(!reader.acquire(index, block))
+                return false;
+            blockIndex = index;
+            return true;
+        }
+    };
+
+    std::shared_ptr<Blocks> mBlocks;
+    std::size_t mIndex;
+
+    bool isAtEnd() const
+    {
+        return !mBlocks || mIndex == npos || !mBlocks->reach(mIndex);
+    }
+
+    public:
+    BlockIt()
+        :mBlocks(nullptr), mIndex(npos)
+    { }
+
+    BlockIt(const std::string& path, std::size_t blockSize, std::size_t buffers)
+        :mBlocks(std::make_shared<Blocks>(path, blockSize, buffers)), mIndex(0)
+    { }
+
+    BlockIt(const BlockIt& other, std::size_t index)
+        :mBlocks(other.mBlocks), mIndex(index)
+    { }
+
+    BlockIt& operator++()
+    {
+        ++mIndex;
+        return *this;
+    }
+
+    BlockIt operator++(int)
+    {
+        auto tmp = *this;
+        ++mIndex;
+        return tmp;
+    }
+
+    const std::string_view& operator*() const
+    {
+        mBlocks->reach(mIndex);
+        return mBlocks->block;
+    }
+
+    const std::string_view* operator->() const
+    {
+        return &(operator*());
+    }
+
+    bool operator==(const BlockIt& other) const
+    {
+        bool atEnd = isAtEnd();
+        bool otherAtEnd = other.isAtEnd();
+        if(atEnd || otherAtEnd)
+            return atEnd == otherAtEnd;
+        return mBlocks == other.mBlocks && mIndex == other.mIndex;
+    }
+
+    bool operator!=(const BlockIt& other) const
+    {
+        return !(*this == other);
+    }
+};
+
+/**
+ * AsyncLineIt is iterator over lines of file read by helper::BlockReader
+ * Lines point into reader's buffer, only line crossing boundary of blocks is copied (to carry string)
+ * Line is valid until iterator is incremented, iterator tag is std::input_iterator_tag
+ */
+class AsyncLineIt : public std::iterator<std::input_iterator_tag, std::string_view, std::ptrdiff_t, const std::string_view*, const std::string_view&>
+{
+    private:
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    struct Lines
+    {
+        helper::BlockReader reader;
+        std::size_t blockIndex;
+        const char* pos;
+        const char* end;
+        std::string carry;
+        bool carried;
+        std::string_view line;
+        std::size_t lineIndex;
+        bool finished;
+
+        Lines(const std::string& path, std::size_t blockSize, std::size_t buffers)
+            :reader(path, blockSize, buffers), blockIndex(npos), pos(nullptr), end(nullptr),
+              carried(false), lineIndex(npos), finished(false)
+        { }
+
+        bool nextBlock()
+        {
+            std::string_view block;
+            if(!reader.acquire(blockIndex == npos ? 0 : blockIndex + 1, block))
+                return false;
+            blockIndex = blockIndex == npos ? 0 : blockIndex + 1;
+            pos = block.data();
+            end = block.data() + block.size();
+            return true;
+        }
+
+        bool nextLine()
+        {
+            if(!carried)
+                carry.clear();
+            while(true)
+            {
+                if(pos == end && !nextBlock())
+                {
+                    if(!carried)
+                        return false;
+                    line = carry;
+                    carried = false;
+                    return true;
+                }
+                auto nl = static_cast<const char*>(std::memchr(pos, '\n', static_cast<std::size_t>(end - pos)));
+                if(!nl)
+                {
+                    carry.append(pos, end);
+                    carried = true;
+                    pos = end;
+                    continue;
+                }
+                if(carried)
+                {
+                    carry.append(pos, nl);
+                    line = carry;
+                    carried = false;
+                }
+                else
+                    line = std::string_view(pos, static_cast<std::size_t>(nl - pos));
+                pos = nl + 1;
+                return true;
+            }
+        }
+
+        bool reach(std::size_t index)
+        {
+            while((lineIndex == npos || lineIndex < index) && !finished)
+            {
+                if(nextLine())
+                    lineIndex = lineIndex == npos ? 0 : lineIndex + 1;
+                else
+                    finished = true;
+            }
+            return lineIndex == index;
+        }
+    };
+
+    std::shared_ptr<Lines> mLines;
+    std::size_t mIndex;
+
+    bool isAtEnd() const
+    {
+        return !mLines || mIndex == npos || !mLines->reach(mIndex);
+    }
+
+    public:
+    AsyncLineIt()
+        :mLines(nullptr), mIndex(npos)
+    { }
+
+    AsyncLineIt(const std::string& path, std::size_t blockSize, std::size_t buffers)
+        :mLines(std::make_shared<Lines>(path, blockSize, buffers)), mIndex(0)
+    { }
+
+    AsyncLineIt(const AsyncLineIt& other, std::size_t index)
+        :mLines(other.mLines), mIndex(index)
+    { }
+
+    AsyncLineIt& operator++()
+    {
+        ++mIndex;
+        return *this;
+    }
+
+    AsyncLineIt operator++(int)
+    {
+        auto tmp = *this;
+        ++mIndex;
+        return tmp;
+    }
+
+    const std::string_view& operator*() const
+    {
+        mLines->reach(mIndex);
+        return mLines->line;
+    }
+
+    const std::string_view* operator->() const
+    {
+        return &(operator*());
+    }
+
+    bool operator==(const AsyncLineIt& other) const
+    {
+        bool atEnd = isAtEnd();
+        bool otherAtEnd = other.isAtEnd();
+        if(atEnd || otherAtEnd)
+            return atEnd == otherAtEnd;
+        return mLines == other.mLines && mIndex == other.mIndex;
+    }
+
+    bool operator!=(const AsyncLineIt& other) const
+    {
+        return !(*this == other);
+    }
+};
+
+
+/**
+ * FUNCTIONS
+ */
+
+/**
+ * Lines of given text, text has to outlive the range
+ */
+inline auto lines(std::string_view text)
+{
+    return Range<LineIt>(LineIt(text.data(), text.data() + text.size()),
+                         LineIt(text.data() + text.size(), text.data() + text.size()));
+}
+
+/**
+ * Lines of mapped file, views point directly to the mapping (file has to outlive the range)
+ */
+inline auto lines(const MappedFile& file)
+{
+    return lines(file.view());
+}
+
+
+/**
+ * Rows of CSV text in memory (text has to outlive the range)
+ */
+inline auto csv(std::string_view text, CsvOptions options = CsvOptions())
+{
+    CsvIt beginIt(text, std::move(options));
+    return Range<CsvIt>(beginIt, CsvIt(beginIt, static_cast<std::size_t>(-1)));
+}
+
+/**
+ * Rows of mapped CSV file (file has to outlive the range)
+ */
+inline auto csv(const MappedFile& file, CsvOptions options = CsvOptions())
+{
+    return csv(file.view(), std::move(options));
+}
+
+/**
+ * Rows of CSV file streamed through read buffer of options.bufferSize bytes
+ */
+inline auto csv_file(const std::string& path, CsvOptions options = CsvOptions())
+{
+    CsvIt beginIt(path, std::move(options));
+    return Range<CsvIt>(beginIt, CsvIt(beginIt, static_cast<std::size_t>(-1)));
+}
+
+
+/**
+ * Blocks of file read ahead on background thread into given number of buffers of blockSize bytes
+ */
+inline auto async_blocks(const std::string& path, std::size_t blockSize = 1 << 20, std::size_t buffers = 2)
+{
+    BlockIt beginIt(path, blockSize, buffers);
+    return Range<BlockIt>(beginIt, BlockIt(beginIt, static_cast<std::size_t>(-1)));
+}
+
+/**
+ * Lines of file read ahead on background thread into given number of buffers of blockSize bytes
+ */
+inline auto async_lines(const std::string& path, std::size_t blockSize = 1 << 20, std::size_t buffers = 2)
+{
+    AsyncLineIt beginIt(path, blockSize, buffers);
+    return Range<AsyncLineIt>(beginIt, AsyncLineIt(beginIt, static_cast<std::size_t>(-1)));
+}
+
+
+/**
+ * Writes text form of each element of range to file, one element per line
+ * Returns number of written elements, errors are reported by std::system_error
+ */
+template<typename Iterator>
+std::size_t write_lines(Iterator first, Iterator last, const std::string& path, SinkOptions options = SinkOptions())
+{
+    helper::FileSink sink(path, options.bufferSize, options.async);
+    std::size_t count = 0;
+    for(; first != last; ++first, ++count)
+    {
+        helper::appendText(sink, *first);
+        helper::appendText(sink, '\n');
+    }
+    sink.close();
+    return count;
+}
+
+/**
+ * Writes raw bytes of each (trivially copyable) element of range to file
+ * Returns number of written elements, errors are reported by std::system_error
+ */
+template<typename Iterator>
+std::size_t write_binary(Iterator first, Iterator last, const std::string& path, SinkOptions options = SinkOptions())
+{
+    using Record = typename std::iterator_traits<Iterator>::value_type;
+    static_assert(std::is_trivially_copyable<Record>::value, "records have to be trivially copyable");
+
+    helper::FileSink sink(path, std::max(options.bufferSize, sizeof(Record)), options.async);
+    std::size_t count = 0;
+    for(; first != last; ++first, ++count)
+    {
+        const Record& record = *first;
+        std::memcpy(sink.reserve(sizeof(Record)), &record, sizeof(Record));
+    }
+    sink.close();
+    return count;
+}
+
+
+} // namespace lazy
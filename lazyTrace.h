@@ -0,0 +1,491 @@
+/*
+ * HW01, lazy functional library - execution tracing
+ * Author: David Kuťák, 433409
+ *
+ * Spans recorded by pipeline stages are written as Chrome trace-event JSON (chrome://tracing, Perfetto)
+ * Program has to be linked with threads library (-pthread)
+ */
+#pragma once
+
+#include "lazy.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace lazy
+{
+
+namespace trace
+{
+
+/**
+ * Complete span, name and category have to outlive the trace (string literals are expected)
+ * Async span is written as begin/end pair on its own track, so it may partially overlap other spans of the thread
+ */
+struct Event
+{
+    const char* name;
+    const char* category;
+    std::uint64_t start;
+    std::uint64_t duration;
+    std::uint64_t elements;
+    bool async = false;
+};
+
+/**
+ * Buffer of events recorded by one thread
+ * Only the owning thread writes, published size lets writer of the trace read complete events without locking
+ * Events over capacity are dropped (and counted)
+ * Buffer is retired when its thread exits, then it may be handed to another thread (which continues
+ * under the same thread id)
+ */
+class ThreadBuffer
+{
+    private:
+    std::unique_ptr<Event[]> mEvents;
+    std::size_t mCapacity;
+    std::atomic<std::size_t> mSize;
+    std::atomic<std::size_t> mDropped;
+    std::atomic<bool> mRetired;
+    std::uint32_t mThreadId;
+
+    public:
+    ThreadBuffer(std::size_t capacity, std::uint32_t threadId)
+        :mEvents(new Event[capacity]), mCapacity(capacity), mSize(0), mDropped(0), mRetired(false), mThreadId(threadId)
+    { }
+
+    void push(const Event& event)
+    {
+        auto size = mSize.load(std::memory_order_relaxed);
+        if(size == mCapacity)
+        {
+            mDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        mEvents[size] = event;
+        mSize.store(size + 1, std::memory_order_release);
+    }
+
+    std::size_t size() const
+    {
+        return mSize.load(std::memory_order_acquire);
+    }
+
+    const Event& operator[](std::size_t index) const
+    {
+        return mEvents[index];
+    }
+
+    std::size_t dropped() const
+    {
+        return mDropped.load(std::memory_order_relaxed);
+    }
+
+    std::uint32_t threadId() const
+    {
+        return mThreadId;
+    }
+
+    std::size_t capacity() const
+    {
+        return mCapacity;
+    }
+
+    bool retired() const
+    {
+        return mRetired.load(std::memory_order_acquire);
+    }
+
+    void retire(bool on)
+    {
+        mRetired.store(on, std::memory_order_release);
+    }
+
+    void clear()
+    {
+        mSize.store(0, std::memory_order_release);
+        mDropped.store(0, std::memory_order_relaxed);
+    }
+};
+
+/**
+ * Recorder owns buffers of all threads which recorded something, buffers outlive their threads
+ * and are reused by new threads, so the registry is bounded by the number of threads recording at once
+ * Registry is locked only when thread records its first event and when the trace is written
+ */
+class Recorder
+{
+    private:
+    std::atomic<bool> mEnabled;
+    std::atomic<std::size_t> mCapacity;
+    std::chrono::steady_clock::time_point mEpoch;
+    std::mutex mRegistryMutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> mBuffers;
+    std::uint32_t mLastThreadId;
+
+    /**
+     * Thread's handle of its buffer, retires the buffer when the thread exits
+     */
+    class Registration
+    {
+        private:
+        std::shared_ptr<ThreadBuffer> mBuffer;
+
+        public:
+        explicit Registration(std::shared_ptr<ThreadBuffer> buffer)
+            :mBuffer(std::move(buffer))
+        { }
+
+        Registration(const Registration&) = delete;
+        Registration& operator=(const Registration&) = delete;
+
+        ThreadBuffer& buffer()
+        {
+            return *mBuffer;
+        }
+
+        ~Registration()
+        {
+            mBuffer->retire(true);
+        }
+    };
+
+    Recorder()
+        :mEnabled(false), mCapacity(1 << 16), mEpoch(std::chrono::steady_clock::now()), mLastThreadId(0)
+    { }
+
+    /**
+     * Hands over retired buffer of current capacity, new buffer is created only when there is none
+     */
+    std::shared_ptr<ThreadBuffer> registerThread()
+    {
+        std::lock_guard<std::mutex> lock(mRegistryMutex);
+        auto capacity = mCapacity.load();
+        for(const auto& buffer : mBuffers)
+        {
+            if(buffer->retired() && buffer->capacity() == capacity)
+            {
+                buffer->retire(false);
+                return buffer;
+            }
+        }
+        auto buffer = std::make_shared<ThreadBuffer>(capacity, ++mLastThreadId);
+        mBuffers.push_back(buffer);
+        return buffer;
+    }
+
+    static void writeString(std::ostream& out, const char* str)
+    {
+        out << '"';
+        for(; *str; ++str)
+        {
+            if(*str == '"' || *str == '\\')
+                out << '\\';
+            out << *str;
+        }
+        out << '"';
+    }
+
+    /**
+     * Nanoseconds as microseconds with fixed 3 decimal places - default formatting of doubles
+     * has 6 significant digits, which is only 10 us resolution after 1 s of tracing
+     */
+    static void writeMicros(std::ostream& out, std::uint64_t nanoseconds)
+    {
+        auto fraction = nanoseconds % 1000;
+        out << nanoseconds / 1000 << '.' << static_cast<char>('0' + fraction / 100)
+            << static_cast<char>('0' + fraction / 10 % 10) << static_cast<char>('0' + fraction % 10);
+    }
+
+    public:
+    static Recorder& instance()
+    {
+        static Recorder recorder;
+        return recorder;
+    }
+
+    bool enabled() const
+    {
+        return mEnabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Capacity applies to buffers of threads which did not record anything yet
+     */
+    void enable(bool on, std::size_t eventsPerThread)
+    {
+        mCapacity.store(std::max<std::size_t>(eventsPerThread, 1));
+        mEnabled.store(on);
+    }
+
+    /**
+     * Nanoseconds since creation of recorder
+     */
+    std::uint64_t now() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - mEpoch).count();
+    }
+
+    void record(const Event& event)
+    {
+        thread_local Registration registration(registerThread());
+        registration.buffer().push(event);
+    }
+
+    /**
+     * Number of buffers in the registry
+     */
+    std::size_t buffers()
+    {
+        std::lock_guard<std::mutex> lock(mRegistryMutex);
+        return mBuffers.size();
+    }
+
+    /**
+     * Events written by running threads after the call starts may be missing
+     */
+    void write(std::ostream& out)
+    {
+        std::lock_guard<std::mutex> lock(mRegistryMutex);
+        out << "{\"traceEvents\": [";
+        bool first = true;
+        std::size_t dropped = 0;
+        for(const auto& buffer : mBuffers)
+        {
+            dropped += buffer->dropped();
+            auto size = buffer->size();
+            for(std::size_t i = 0; i < size; ++i)
+            {
+                const auto& e = (*buffer)[i];
+                out << (first ? "\n" : ",\n") << "{\"name\": ";
+                writeString(out, e.name);
+                out << ", \"cat\": ";
+                writeString(out, e.category);
+                if(e.async)
+                {
+                    // tracks of async spans are per thread
+                    out << ", \"ph\": \"b\", \"id\": " << buffer->threadId() << ", \"pid\": 1, \"tid\": " << buffer->threadId() << ", \"ts\": ";
+                    writeMicros(out, e.start);
+                    out << ", \"args\": {\"elements\": " << e.elements << "}},\n{\"name\": ";
+                    writeString(out, e.name);
+                    out << ", \"cat\": ";
+                    writeString(out, e.category);
+                    out << ", \"ph\": \"e\", \"id\": " << buffer->threadId() << ", \"pid\": 1, \"tid\": " << buffer->threadId() << ", \"ts\": ";
+                    writeMicros(out, e.start + e.duration);
+                    out << "}";
+                }
+                else
+                {
+                    out << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->threadId() << ", \"ts\": ";
+                    writeMicros(out, e.start);
+                    out << ", \"dur\": ";
+                    writeMicros(out, e.duration);
+                    out << ", \"args\": {\"elements\": " << e.elements << "}}";
+                }
+                first = false;
+            }
+        }
+        out << "\n], \"displayTimeUnit\": \"ns\", \"otherData\": {\"dropped\": " << dropped << "}}\n";
+    }
+
+    /**
+     * Has to be called when no thread records
+     * Retired buffers of other than current capacity would not be reused, they are freed
+     */
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mRegistryMutex);
+        auto capacity = mCapacity.load();
+        mBuffers.erase(std::remove_if(mBuffers.begin(), mBuffers.end(), [capacity](const std::shared_ptr<ThreadBuffer>& buffer){
+            return buffer->retired() && buffer->capacity() != capacity;
+        }), mBuffers.end());
+        for(auto& buffer : mBuffers)
+            buffer->clear();
+    }
+};
+
+/**
+ * FUNCTIONS
+ */
+
+inline void enable(std::size_t eventsPerThread = 1 << 16)
+{
+    Recorder::instance().enable(true, eventsPerThread);
+}
+
+inline void disable()
+{
+    Recorder::instance().enable(false, 1 << 16);
+}
+
+inline bool enabled()
+{
+    return Recorder::instance().enabled();
+}
+
+inline void write(std::ostream& out)
+{
+    Recorder::instance().write(out);
+}
+
+inline bool write(const std::string& path)
+{
+    std::ofstream out(path);
+    write(out);
+    return static_cast<bool>(out);
+}
+
+inline void clear()
+{
+    Recorder::instance().clear();
+}
+
+/**
+ * Records span from construction (or start) to destruction (or finish) when tracing is enabled at its start
+ * Spans without elements are not recorded
+ */
+class Span
+{
+    private:
+    const char* mName;
+    const char* mCategory;
+    std::uint64_t mStart;
+    std::uint64_t mElements;
+    bool mActive;
+
+    public:
+    explicit Span(const char* name, const char* category = "lazy", std::uint64_t elements = 1)
+        :mName(name), mCategory(category), mStart(0), mElements(0), mActive(false)
+    {
+        start(elements);
+    }
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+    void start(std::uint64_t elements = 1)
+    {
+        mElements = elements;
+        mActive = enabled();
+        if(mActive)
+            mStart = Recorder::instance().now();
+    }
+
+    void setElements(std::uint64_t elements)
+    {
+        mElements = elements;
+    }
+
+    void finish()
+    {
+        if(mActive && mElements)
+        {
+            auto& recorder = Recorder::instance();
+            recorder.record({mName, mCategory, mStart, recorder.now() - mStart, mElements});
+        }
+        mActive = false;
+    }
+
+    ~Span()
+    {
+        finish();
+    }
+};
+
+}
+
+/**
+ * Statistics policy of MapIt, FilterIt, ZipIt and unique which records span for each chunk of function calls
+ * e.g. lazy::map(first, last, f, lazy::Traced("parse"))
+ * Chunk spans from the start of its first call to the end of its last call, clock is read only at chunk boundaries
+ * Work of other stages running between the calls falls inside the span, so chunk spans are async spans
+ * (own track per thread) which may overlap spans of other stages
+ * Each copy of iterator keeps its own chunk, unfinished chunk is recorded (ending at that moment) when the iterator is destroyed
+ */
+class Traced
+{
+    private:
+    const char* mName;
+    std::size_t mChunk;
+    std::size_t mCalls;
+    std::uint64_t mChunkStart;
+
+    void flush()
+    {
+        if(mCalls)
+        {
+            auto& recorder = trace::Recorder::instance();
+            recorder.record({mName, "stage", mChunkStart, recorder.now() - mChunkStart, mCalls, true});
+        }
+        mCalls = 0;
+    }
+
+    class CallGuard
+    {
+        private:
+        Traced& mOwner;
+
+        public:
+        explicit CallGuard(Traced& owner)
+            :mOwner(owner)
+        {
+            if(mOwner.mCalls++ == 0)
+                mOwner.mChunkStart = trace::Recorder::instance().now();
+        }
+
+        ~CallGuard()
+        {
+            if(mOwner.mCalls == mOwner.mChunk)
+                mOwner.flush();
+        }
+    };
+
+    public:
+    // Only spans are recorded, counters of unique are not needed
+    static constexpr bool enabled = false;
+
+    explicit Traced(const char* name = "stage", std::size_t chunk = 1024)
+        :mName(name), mChunk(std::max<std::size_t>(chunk, 1)), mCalls(0), mChunkStart(0)
+    { }
+
+    Traced(const Traced& other)
+        :mName(other.mName), mChunk(other.mChunk), mCalls(0), mChunkStart(0)
+    { }
+
+    Traced& operator=(const Traced& other)
+    {
+        flush();
+        mName = other.mName;
+        mChunk = other.mChunk;
+        return *this;
+    }
+
+    ~Traced()
+    {
+        flush();
+    }
+
+    void onPull() {}
+    void onYield() {}
+    void onCacheHit() {}
+    void onUnique(std::size_t, std::size_t) {}
+
+    template<typename F>
+    decltype(auto) onCall(F&& f)
+    {
+        if(!trace::enabled())
+            return f();
+        CallGuard guard(*this);
+        return f();
+    }
+};
+
+} // namespace lazy
@@ -0,0 +1,332 @@
+#include "catch.hpp"
+#include "lazy.h"
+#include "lazyAny.h"
+#include "lazyAsync.h"
+#include "allocationCounter.h"
+#include <string>
+#include <vector>
+
+namespace
+{
+
+/**
+ * Walks range by prefix ++ and counts heap allocations done after the first element
+ * (the first dereference may allocate result caches of stages)
+ */
+template<typename R>
+std::size_t walkAllocations(R range, std::size_t& elements)
+{
+    auto it = range.begin();
+    auto end = range.end();
+    elements = 0;
+    if(it != end)
+    {
+        volatile auto value = *it;
+        (void)value;
+        ++elements;
+        ++it;
+    }
+    allocation::Scope scope;
+    for(; it != end; ++it)
+    {
+        volatile auto value = *it;
+        (void)value;
+        ++elements;
+    }
+    return scope.allocations();
+}
+
+/**
+ * Allocator of another type than std::allocator or ArenaAllocator
+ */
+template<typename T>
+struct PlainAllocator
+{
+    using value_type = T;
+
+    PlainAllocator() = default;
+
+    template<typename U>
+    PlainAllocator(const PlainAllocator<U>&)
+    { }
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t)
+    {
+        ::operator delete(p);
+    }
+
+    template<typename U>
+    bool operator==(const PlainAllocator<U>&) const
+    {
+        return true;
+    }
+
+    template<typename U>
+    bool operator!=(const PlainAllocator<U>&) const
+    {
+        return false;
+    }
+};
+
+template<typename It>
+std::size_t copyAllocations(const It& it)
+{
+    allocation::Scope scope;
+    It copy(it);
+    (void)copy;
+    return scope.allocations();
+}
+
+}
+
+TEST_CASE("heap allocations", "[alloc]")
+{
+    std::vector<int> data;
+    for(int i = 0; i < 10000; ++i)
+        data.push_back(i % 100);
+    std::size_t elements = 0;
+
+    SECTION("stages do not allocate per element")
+    {
+        auto m = lazy::map(data.begin(), data.end(), [](int x){return x * 2;});
+        REQUIRE(walkAllocations(m, elements) == 0);
+        REQUIRE(elements == data.size());
+
+        auto f = lazy::filter(data.begin(), data.end(), [](int x){return x % 2 == 0;});
+        REQUIRE(walkAllocations(f, elements) == 0);
+        REQUIRE(elements == data.size() / 2);
+
+        auto z = lazy::zip(data.begin(), data.end(), data.begin(), data.end(), [](int x, int y){return x + y;});
+        REQUIRE(walkAllocations(z, elements) == 0);
+        REQUIRE(elements == data.size());
+    }
+
+    SECTION("chained pipeline does not allocate per element")
+    {
+        auto f = lazy::filter(data.begin(), data.end(), [](int x){return x % 3 == 0;});
+        auto m = lazy::map(f.begin(), f.end(), [](int x){return std::to_string(x);});
+        auto z = lazy::zip(m.begin(), m.end(), f.begin(), f.end(), [](const std::string& s, int x){return s.size() + x;});
+        REQUIRE(walkAllocations(z, elements) == 0);
+        REQUIRE(elements == 3400);
+    }
+
+    SECTION("unique allocates only for distinct values")
+    {
+        auto u = lazy::unique(data.begin(), data.end());
+        auto allocations = walkAllocations(u, elements);
+        REQUIRE(elements == 100);
+        // one node per distinct value and few rehashes of bucket array
+        REQUIRE(allocations <= 100 + 16);
+    }
+
+    SECTION("stage reuses batches on producer thread")
+    {
+        // counters are per thread, the function runs on producer thread
+        std::size_t first = 0, last = 0;
+        auto m = lazy::map(data.begin(), data.end(), [&](int x){
+            if(first == 0)
+                first = allocation::current().allocations + 1;
+            last = allocation::current().allocations + 1;
+            return x;
+        });
+        auto s = lazy::stage(m.begin(), m.end(), 10, 4);
+        long sum = 0;
+        for(auto it = s.begin(); it != s.end(); ++it)
+            sum += *it;
+        REQUIRE(sum == 100 * 4950);
+        // 1000 batches, only those not yet returned by consumer are allocated
+        REQUIRE(last - first <= 4 + 2);
+    }
+
+    SECTION("iterator copies")
+    {
+        auto m = lazy::map(data.begin(), data.end(), [](int x){return x * 2;});
+        auto f = lazy::filter(data.begin(), data.end(), [](int x){return x % 2 == 0;});
+        auto z = lazy::zip(data.begin(), data.end(), data.begin(), data.end(), [](int x, int y){return x + y;});
+
+        auto mapIt = m.begin();
+        auto zipIt = z.begin();
+        // underlying iterators only, captureless functions fit into std::function
+        REQUIRE(copyAllocations(mapIt) <= 1);
+        REQUIRE(copyAllocations(f.begin()) <= 2);
+        REQUIRE(copyAllocations(zipIt) <= 2);
+        // plus cached result
+        *mapIt;
+        *zipIt;
+        REQUIRE(copyAllocations(mapIt) <= 2);
+        REQUIRE(copyAllocations(zipIt) <= 3);
+
+        auto u = lazy::unique(data.begin(), data.end());
+        REQUIRE(copyAllocations(u.end()) <= 2);
+    }
+
+    SECTION("erased iterators stay in place")
+    {
+        auto u = lazy::unique(data.begin(), data.end());
+        auto z = lazy::zip(data.begin(), data.end(), data.begin(), data.end(), [](int x, int y){return x + y;});
+        allocation::Scope scope;
+        lazy::any_iterator<int> plain(data.begin());
+        lazy::any_iterator<int> plainCopy(plain);
+        auto allocations = scope.allocations();
+        REQUIRE(allocations == 0);
+
+        // only copies of wrapped lazy iterators allocate (see iterator copies)
+        lazy::any_iterator<int> end(u.end());
+        REQUIRE(copyAllocations(end) == copyAllocations(u.end()));
+        lazy::any_iterator<int> zipIt(z.begin());
+        REQUIRE(copyAllocations(zipIt) == copyAllocations(z.begin()));
+        REQUIRE(zipIt.memory_usage() == z.begin().memory_usage());
+    }
+
+    SECTION("postfix increment")
+    {
+        auto m = lazy::map(data.begin(), data.end(), [](int x){return x * 2;});
+        auto it = m.begin();
+        *it;
+        allocation::Scope scope;
+        for(int i = 0; i < 100; ++i)
+            it++;
+        auto allocations = scope.allocations();
+        // at most the underlying iterator of returned copy per increment, cached result is handed over
+        REQUIRE(allocations <= 100);
+    }
+}
+
+TEST_CASE("arena allocation", "[alloc]")
+{
+    std::vector<int> data;
+    for(int i = 0; i < 10000; ++i)
+        data.push_back(i % 1000);
+    std::size_t elements = 0;
+
+    SECTION("monotonic arena")
+    {
+        lazy::MonotonicArena arena(1024);
+        auto a = static_cast<char*>(arena.allocate(3, 1));
+        auto b = arena.allocate(sizeof(double), alignof(double));
+        REQUIRE(reinterpret_cast<std::uintptr_t>(b) % alignof(double) == 0);
+        REQUIRE(reinterpret_cast<std::uintptr_t>(b) >= reinterpret_cast<std::uintptr_t>(a) + 3);
+        REQUIRE(arena.chunks() == 1);
+
+        // request bigger than a chunk gets chunk of its own
+        arena.allocate(4096);
+        REQUIRE(arena.chunks() == 2);
+        REQUIRE(arena.reserved() >= 1024 + 4096);
+        REQUIRE(arena.allocated() == 3 + sizeof(double) + 4096);
+
+        arena.release();
+        REQUIRE(arena.chunks() == 0);
+        REQUIRE(arena.allocated() == 0);
+    }
+
+    SECTION("huge page chunks")
+    {
+        lazy::MonotonicArena arena(1024, true);
+        auto memory = static_cast<int*>(arena.allocate(1000 * sizeof(int), alignof(int)));
+        for(int i = 0; i < 1000; ++i)
+            memory[i] = i;
+        REQUIRE(memory[999] == 999);
+        REQUIRE(arena.reserved() >= 1000 * sizeof(int));
+    }
+
+    SECTION("unique draws its set from the arena")
+    {
+        lazy::MonotonicArena arena;
+        auto u = lazy::unique(data.begin(), data.end(), lazy::MemoryBudget(), lazy::NoStats(), lazy::ArenaAllocator<int>(arena));
+        REQUIRE(walkAllocations(u, elements) == 0);
+        REQUIRE(elements == 1000);
+        REQUIRE(arena.allocated() > 1000 * sizeof(int));
+        REQUIRE(u.begin().memory_usage() > 0);
+
+        // allocator may be given for any type, it is rebound to the value type
+        auto same = lazy::unique(data.begin(), data.end(), lazy::MemoryBudget(), lazy::NoStats(), lazy::ArenaAllocator<char>(arena));
+        std::vector<int> result;
+        for(auto it = same.begin(); it != same.end(); ++it)
+            result.push_back(*it);
+        REQUIRE(result.size() == 1000);
+        REQUIRE(result.back() == 999);
+    }
+
+    SECTION("copies of arena-backed unique share the set")
+    {
+        lazy::MonotonicArena arena(1024);
+        auto u = lazy::unique(data.begin(), data.end(), lazy::MemoryBudget(), lazy::NoStats(), lazy::ArenaAllocator<int>(arena));
+        auto copied = u;
+        std::vector<int> result;
+        // postfix ++ copies the iterator for every element, arena grows only with distinct values
+        for(auto it = copied.begin(); it != copied.end(); )
+            result.push_back(*it++);
+        REQUIRE(result.size() == 1000);
+        REQUIRE(result.back() == 999);
+        REQUIRE(arena.allocated() < 64 * 1000);
+    }
+
+    SECTION("unique reports its set with any allocator and statistics")
+    {
+        auto u = lazy::unique(data.begin(), data.end(), lazy::MemoryBudget(), lazy::NoStats(), PlainAllocator<int>());
+        auto it = u.begin();
+        while(it != u.end())
+            ++it;
+        REQUIRE(it.memory_usage() > 1000 * sizeof(int));
+
+        lazy::StageStats stats;
+        auto counted = lazy::unique(data.begin(), data.end(), lazy::Counting(stats));
+        auto countedIt = counted.begin();
+        while(countedIt != counted.end())
+            ++countedIt;
+        REQUIRE(countedIt.memory_usage() > 1000 * sizeof(int));
+        REQUIRE(counted.end().memory_usage() == 2 * sizeof(decltype(data.begin())));
+    }
+
+    SECTION("unique of strings is torn down normally")
+    {
+        std::vector<std::string> words;
+        for(int i = 0; i < 100; ++i)
+            words.push_back("a long string which does not fit into small buffer " + std::to_string(i % 50));
+        std::size_t n = 0;
+        allocation::Scope scope;
+        {
+            lazy::MonotonicArena arena;
+            auto u = lazy::unique(words.begin(), words.end(), lazy::MemoryBudget(), lazy::NoStats(), lazy::ArenaAllocator<std::string>(arena));
+            for(auto it = u.begin(); it != u.end(); ++it)
+                ++n;
+        }
+        auto counts = scope.counts();
+        REQUIRE(n == 50);
+        // buffers of strings copied into the set (and arena chunks) are all freed
+        REQUIRE(counts.allocations >= 50);
+        REQUIRE(counts.deallocations == counts.allocations);
+    }
+
+    SECTION("teardown is skipped only for trivially destructible values")
+    {
+        using IntFunc = lazy::helper::UniqueFunc<int, lazy::NoStats, lazy::ArenaAllocator<int>>;
+        using StringFunc = lazy::helper::UniqueFunc<std::string, lazy::NoStats, lazy::ArenaAllocator<std::string>>;
+        using HeapFunc = lazy::helper::UniqueFunc<int>;
+        REQUIRE((std::is_same<IntFunc::Holder, lazy::helper::StateHolder<IntFunc::Set, true>>::value));
+        REQUIRE((std::is_same<StringFunc::Holder, lazy::helper::StateHolder<StringFunc::Set, false>>::value));
+        REQUIRE((std::is_same<HeapFunc::Holder, lazy::helper::StateHolder<HeapFunc::Set, false>>::value));
+    }
+
+    SECTION("cache buffers into the arena")
+    {
+        lazy::MonotonicArena arena(1024);
+        auto c = lazy::cache(data.begin(), data.end(), lazy::ArenaAllocator<int>(arena));
+        auto chunks = arena.chunks();
+        allocation::Scope scope;
+        int sum = 0;
+        for(auto it = c.begin(); it != c.end(); ++it)
+            sum += *it;
+        auto allocations = scope.allocations();
+        REQUIRE(sum == 10 * 499500);
+        // only new chunks of the arena come from the heap
+        REQUIRE(allocations == arena.chunks() - chunks);
+        REQUIRE(allocations > 0);
+        REQUIRE(c.begin().memory_usage() >= data.size() * sizeof(int));
+    }
+}
@@ -0,0 +1,127 @@
+#include "catch.hpp"
+#include "lazy.h"
+#include "lazyAny.h"
+#include <array>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace
+{
+
+// Only the signature is visible to callers, type of the pipeline stays here
+lazy::any_range<int> an_evenSquares(const std::vector<int>& data)
+{
+    auto f = lazy::filter(data.begin(), data.end(), [](int x){return x % 2 == 0;});
+    return lazy::map(f.begin(), f.end(), [](int x){return x * x;});
+}
+
+struct BigIterator
+{
+    std::vector<int>::const_iterator it;
+    std::array<char, 256> padding;
+
+    int operator*() const
+    {
+        return *it;
+    }
+
+    BigIterator& operator++()
+    {
+        ++it;
+        return *this;
+    }
+
+    bool operator==(const BigIterator& other) const
+    {
+        return it == other.it;
+    }
+
+    bool operator!=(const BigIterator& other) const
+    {
+        return it != other.it;
+    }
+};
+
+}
+
+TEST_CASE("any_range", "[any]")
+{
+    std::vector<int> data {1, 2, 3, 4, 5, 6, 7, 8};
+
+    SECTION("pipeline across function boundary")
+    {
+        auto r = an_evenSquares(data);
+        std::vector<int> result;
+        for(auto it = r.begin(); it != r.end(); ++it)
+            result.push_back(*it);
+        REQUIRE(result == std::vector<int>({4, 16, 36, 64}));
+
+        // lazy stages accept erased ranges
+        auto m = lazy::map(r.begin(), r.end(), [](int x){return x + 1;});
+        result.assign(m.begin(), m.end());
+        REQUIRE(result == std::vector<int>({5, 17, 37, 65}));
+    }
+
+    SECTION("copies are independent")
+    {
+        lazy::any_range<int> r(data);
+        auto a = r.begin();
+        ++a;
+        auto b = a;
+        ++b;
+        REQUIRE(*a == 2);
+        REQUIRE(*b == 3);
+        REQUIRE(a != b);
+        auto previous = a++;
+        REQUIRE(*previous == 2);
+        REQUIRE(a == b);
+
+        // copy of non-const iterator is not wrapped in another any_iterator
+        lazy::any_iterator<int> c(a);
+        REQUIRE(c == a);
+        REQUIRE(c.memory_usage() == 0);
+        static_assert(!std::is_constructible<lazy::any_iterator<int>, std::string>::value, "only iterators are wrapped");
+        static_assert(!std::is_constructible<lazy::any_iterator<int>, std::vector<std::string>::iterator>::value,
+                      "elements have to be convertible");
+
+        lazy::any_iterator<int> empty;
+        REQUIRE(empty == lazy::any_iterator<int>());
+        REQUIRE(empty != r.end());
+        empty = b;
+        REQUIRE(empty == b);
+    }
+
+    SECTION("batched for_each")
+    {
+        std::vector<int> big;
+        for(int i = 0; i < 1000; ++i)
+            big.push_back(i);
+        auto m = lazy::map(big.begin(), big.end(), [](int x){return std::to_string(x);});
+        lazy::any_range<std::string> r(m);
+
+        std::size_t count = 0, chars = 0;
+        r.for_each([&](const std::string& s){ ++count; chars += s.size(); });
+        REQUIRE(count == 1000);
+        REQUIRE(chars == 10 + 90 * 2 + 900 * 3);
+
+        std::string batch[64];
+        auto it = r.begin();
+        REQUIRE(it.read(batch, 64, r.end()) == 64);
+        REQUIRE(batch[63] == "63");
+        REQUIRE(*it == "64");
+    }
+
+    SECTION("big iterators are stored on the heap")
+    {
+        static_assert(sizeof(BigIterator) > lazy::any_iterator<int>::inlineBytes, "iterator has to be bigger than the buffer");
+        lazy::any_range<int> r(BigIterator{data.cbegin(), {}}, BigIterator{data.cend(), {}});
+        int sum = 0;
+        r.for_each([&sum](int x){ sum += x; });
+        REQUIRE(sum == 36);
+        auto copy = r;
+        REQUIRE(std::distance(copy.begin(), copy.end()) == 8);
+        REQUIRE(r.begin().memory_usage() >= sizeof(BigIterator));
+        REQUIRE(lazy::any_range<int>(data).begin().memory_usage() == 0);
+    }
+}
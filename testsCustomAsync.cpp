@@ -0,0 +1,205 @@
+#include "catch.hpp"
+#include "lazyAsync.h"
+#include <atomic>
+#include <chrono>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+template<typename I, typename T>
+void a_check(I first, I last, std::initializer_list<T> expected)
+{
+    bool res = std::equal(first, last, expected.begin(), expected.end());
+    REQUIRE(res);
+}
+
+}
+
+TEST_CASE("async map", "[async]")
+{
+    SECTION("forward source keeps order")
+    {
+        std::vector<int> data(200);
+        for(int i = 0; i < 200; ++i)
+            data[i] = i;
+
+        std::atomic<int> calls(0);
+        auto m = lazy::async_map(data.begin(), data.end(), [&calls](int x) {
+            ++calls;
+            std::this_thread::sleep_for(std::chrono::microseconds((x * 7) % 13));
+            return std::to_string(x);
+        }, 8);
+
+        int expected = 0;
+        for(auto it = m.begin(); it != m.end(); ++it, ++expected)
+            REQUIRE(*it == std::to_string(expected));
+        REQUIRE(expected == 200);
+        REQUIRE(calls == 200);
+    }
+
+    SECTION("input source, chained")
+    {
+        std::istringstream str("1 2 3 4 5 6");
+        auto m = lazy::async_map(std::istream_iterator<int>(str), std::istream_iterator<int>(), [](int x){return x * x;}, 3);
+        auto f = lazy::filter(m.begin(), m.end(), [](int x){return x % 2 == 0;});
+        a_check(f.begin(), f.end(), {4, 16, 36});
+    }
+
+    SECTION("shared pool, early stop")
+    {
+        auto pool = std::make_shared<lazy::ThreadPool>(2);
+        std::vector<int> data {1, 2, 3, 4, 5, 6, 7, 8};
+        {
+            auto m = lazy::async_map(data.begin(), data.end(), [](int x){return x + 1;}, 4, pool);
+            auto it = m.begin();
+            REQUIRE(*it == 2);
+            ++it;
+            ++it;
+            REQUIRE(*it == 4);
+        }
+        auto m = lazy::async_map(data.begin(), data.end(), [](int x){return x - 1;}, 16, pool);
+        a_check(m.begin(), m.end(), {0, 1, 2, 3, 4, 5, 6, 7});
+
+        auto empty = lazy::async_map(data.end(), data.end(), [](int x){return x;}, 4, pool);
+        REQUIRE(empty.begin() == empty.end());
+    }
+
+    SECTION("exceptions are delivered to consumer")
+    {
+        std::vector<int> data {1, 0, 2};
+        auto m = lazy::async_map(data.begin(), data.end(), [](int x){
+            if(x == 0)
+                throw std::runtime_error("zero");
+            return 10 / x;
+        }, 2);
+        auto it = m.begin();
+        REQUIRE(*it == 10);
+        ++it;
+        REQUIRE_THROWS_AS(*it, const std::runtime_error&);
+        REQUIRE_THROWS_AS(*it, const std::runtime_error&);
+        // walk continues after the failed element
+        ++it;
+        REQUIRE(*it == 5);
+        ++it;
+        REQUIRE(it == m.end());
+
+        std::vector<int> many {1, 2, 0, 4, 0, 0, 7, 8};
+        auto n = lazy::async_map(many.begin(), many.end(), [](int x){
+            if(x == 0)
+                throw std::runtime_error("zero");
+            return x;
+        }, 3);
+        int sum = 0;
+        int failed = 0;
+        for(auto i = n.begin(); i != n.end(); ++i)
+        {
+            try
+            {
+                sum += *i;
+            }
+            catch(const std::runtime_error&)
+            {
+                ++failed;
+            }
+        }
+        REQUIRE(sum == 22);
+        REQUIRE(failed == 3);
+    }
+}
+
+TEST_CASE("staged pipeline", "[async]")
+{
+    std::vector<int> data(10000);
+    for(int i = 0; i < 10000; ++i)
+        data[i] = i % 1000;
+
+    SECTION("filter -> map -> unique on three threads")
+    {
+        auto f = lazy::filter(data.begin(), data.end(), [](int x){return x % 3 == 0;});
+        auto s1 = lazy::stage(f.begin(), f.end(), 64, 4);
+        auto m = lazy::map(s1.begin(), s1.end(), [](int x){return x / 2;});
+        auto s2 = lazy::stage(m.begin(), m.end(), 32, 2);
+        auto u = lazy::unique(s2.begin(), s2.end());
+
+        auto fs = lazy::filter(data.begin(), data.end(), [](int x){return x % 3 == 0;});
+        auto ms = lazy::map(fs.begin(), fs.end(), [](int x){return x / 2;});
+        auto us = lazy::unique(ms.begin(), ms.end());
+
+        std::vector<int> expected(us.begin(), us.end());
+        std::vector<int> result(u.begin(), u.end());
+        REQUIRE(result == expected);
+        REQUIRE(result.size() == 334);
+    }
+
+    SECTION("backpressure and early stop")
+    {
+        std::atomic<int> produced(0);
+        auto m = lazy::map(data.begin(), data.end(), [&produced](int x){++produced; return x;});
+        {
+            auto s = lazy::stage(m.begin(), m.end(), 10, 2);
+            auto it = s.begin();
+            REQUIRE(*it == 0);
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            // At most consumed batch, queued batches and the one being filled
+            REQUIRE(produced <= 10 * 4 + 1);
+        }
+        REQUIRE(produced < 10000);
+    }
+
+    SECTION("waiting threads sleep")
+    {
+        // waits until the other side of the queue is parked, spinning phase is short
+        auto parked = [](const lazy::helper::SpscQueue<int>& queue){
+            for(int i = 0; i < 5000 && !queue.sleeping(); ++i)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            return queue.sleeping() == 1;
+        };
+
+        // producer blocked by full queue
+        lazy::helper::SpscQueue<int> full(2);
+        std::thread producer([&full]{
+            for(int i = 0; i < 3; ++i)
+                full.push(int(i));
+            full.close();
+        });
+        REQUIRE(parked(full));
+        int value = -1;
+        for(int i = 0; i < 3; ++i)
+        {
+            REQUIRE(full.pop(value));
+            REQUIRE(value == i);
+        }
+        REQUIRE_FALSE(full.pop(value));
+        producer.join();
+        REQUIRE(full.sleeping() == 0);
+
+        // consumer blocked by empty queue
+        lazy::helper::SpscQueue<int> empty(2);
+        std::thread consumer([&empty, &value]{
+            empty.pop(value);
+        });
+        REQUIRE(parked(empty));
+        empty.push(42);
+        consumer.join();
+        REQUIRE(value == 42);
+        REQUIRE(empty.sleeping() == 0);
+    }
+
+    SECTION("empty source and producer errors")
+    {
+        auto e = lazy::stage(data.end(), data.end());
+        REQUIRE(e.begin() == e.end());
+
+        auto m = lazy::map(data.begin(), data.end(), [](int x){
+            if(x == 500)
+                throw std::runtime_error("bad element");
+            return x;
+        });
+        auto s = lazy::stage(m.begin(), m.end(), 100, 2);
+        REQUIRE_THROWS_AS(std::vector<int>(s.begin(), s.end()), const std::runtime_error&);
+    }
+}
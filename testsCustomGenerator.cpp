@@ -0,0 +1,116 @@
+#include "catch.hpp"
+
+#if __cplusplus > 201703L
+
+#include "lazyGenerator.h"
+#include <string>
+#include <vector>
+
+namespace
+{
+
+template<typename I, typename T>
+void g_check(I first, I last, std::initializer_list<T> expected)
+{
+    bool res = std::equal(first, last, expected.begin(), expected.end());
+    REQUIRE(res);
+}
+
+/**
+ * Same sequence as SequenceGenerator in studentExtraTests.cpp: 1, 1 2, 1 2 3, ...
+ */
+lazy::generator<int> sequence(int limit)
+{
+    for(int seq = 1, n = 0; ; ++seq)
+        for(int value = 1; value <= seq; ++value, ++n)
+        {
+            if(n == limit)
+                co_return;
+            co_yield value;
+        }
+}
+
+lazy::generator<std::string> words()
+{
+    std::string word = "a";
+    for(int i = 0; i < 4; ++i)
+    {
+        co_yield word;
+        word += "b";
+    }
+}
+
+lazy::generator<int> failing()
+{
+    co_yield 1;
+    throw std::runtime_error("generator failed");
+}
+
+}
+
+TEST_CASE("coroutine generator", "[generator]")
+{
+    SECTION("plain iteration")
+    {
+        auto g = sequence(6);
+        g_check(g.begin(), g.end(), {1, 1, 2, 1, 2, 3});
+
+        auto empty = sequence(0);
+        REQUIRE(empty.begin() == empty.end());
+    }
+
+    SECTION("map, filter, unique")
+    {
+        auto g = sequence(1000 * 1000);
+        auto u = lazy::unique(g.begin(), g.end());
+        // std::max_element needs forward iterators, generator is input one
+        int maxValue = 0;
+        for(auto it = u.begin(); it != u.end(); ++it)
+            maxValue = std::max(maxValue, *it);
+        REQUIRE(1413 == maxValue);
+
+        auto g2 = sequence(10);
+        auto f = lazy::filter(g2.begin(), g2.end(), [](int x){return x > 1;});
+        auto m = lazy::map(f.begin(), f.end(), [](int x){return x * 10;});
+        g_check(m.begin(), m.end(), {20, 20, 30, 20, 30, 40});
+    }
+
+    SECTION("zip, values by reference")
+    {
+        auto w = words();
+        auto g = sequence(10);
+        auto z = lazy::zip(w.begin(), w.end(), g.begin(), g.end(), [](const std::string& s, int x){return s + std::to_string(x);});
+        g_check(z.begin(), z.end(), {"a1", "ab1", "abb2", "abbb1"});
+
+        auto w2 = words();
+        auto it = w2.begin();
+        const std::string* first = &*it;
+        ++it;
+        REQUIRE(&*it == first);
+        REQUIRE(*it == "ab");
+    }
+
+    SECTION("frames are recycled")
+    {
+        const void* frame = nullptr;
+        for(int i = 0; i < 10; ++i)
+        {
+            auto g = sequence(3);
+            auto it = g.begin();
+            const void* value = &*it;
+            if(frame)
+                REQUIRE(value == frame);
+            frame = value;
+        }
+    }
+
+    SECTION("exceptions")
+    {
+        auto g = failing();
+        auto it = g.begin();
+        REQUIRE(*it == 1);
+        REQUIRE_THROWS_AS(++it, const std::runtime_error&);
+    }
+}
+
+#endif
@@ -0,0 +1,394 @@
+#include "catch.hpp"
+
+#if __cplusplus >= 201703L
+
+#include "lazyIO.h"
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+template<typename I, typename T>
+void io_check(I first, I last, std::initializer_list<T> expected)
+{
+    bool res = std::equal(first, last, expected.begin(), expected.end());
+    REQUIRE(res);
+}
+
+/**
+ * Temporary file with given content, removed at the end of the test
+ */
+struct TempFile
+{
+    std::string path;
+
+    explicit TempFile(const std::string& content)
+    {
+        char name[] = "/tmp/lazyTestXXXXXX";
+        int fd = ::mkstemp(name);
+        REQUIRE(fd >= 0);
+        ::close(fd);
+        path = name;
+        std::ofstream(path, std::ios::binary) << content;
+    }
+
+    ~TempFile()
+    {
+        std::remove(path.c_str());
+    }
+};
+
+}
+
+TEST_CASE("mapped file lines", "[io]")
+{
+    SECTION("in-memory text")
+    {
+        auto l1 = lazy::lines("a\nbb\n\nccc");
+        io_check(l1.begin(), l1.end(), {"a", "bb", "", "ccc"});
+
+        auto l2 = lazy::lines("a\n");
+        io_check(l2.begin(), l2.end(), {"a"});
+
+        auto l3 = lazy::lines("");
+        REQUIRE(l3.begin() == l3.end());
+    }
+
+    SECTION("grep-like pipeline over file")
+    {
+        std::string content = "INFO start\nERROR disk full\nINFO retry\nERROR disk full\nERROR timeout\n";
+        TempFile tmp(content);
+        lazy::MappedFile file(tmp.path);
+        REQUIRE(file.size() == content.size());
+
+        auto l = lazy::lines(file);
+        auto f = lazy::filter(l.begin(), l.end(), [](std::string_view line){return line.substr(0, 5) == "ERROR";});
+        auto m = lazy::map(f.begin(), f.end(), [](std::string_view line){return line.substr(6);});
+        auto u = lazy::unique(m.begin(), m.end());
+        io_check(u.begin(), u.end(), {"disk full", "timeout"});
+
+        // Views point into the mapping
+        REQUIRE(l.begin()->data() == file.data());
+    }
+
+    SECTION("empty and missing files")
+    {
+        TempFile tmp("");
+        lazy::MappedFile file(tmp.path);
+        auto l = lazy::lines(file);
+        REQUIRE(l.begin() == l.end());
+
+        REQUIRE_THROWS_AS(lazy::MappedFile("/nonexistent/lazy/file"), const std::system_error&);
+    }
+}
+
+namespace
+{
+struct Sample
+{
+    std::uint32_t sensor;
+    float value;
+    std::uint64_t time;
+};
+
+std::string sampleBytes(std::size_t n)
+{
+    std::vector<Sample> samples;
+    for(std::size_t i = 0; i < n; ++i)
+        samples.push_back(Sample{static_cast<std::uint32_t>(i % 4), static_cast<float>(i) / 2, i * 10});
+    return std::string(reinterpret_cast<const char*>(samples.data()), n * sizeof(Sample));
+}
+}
+
+TEST_CASE("binary record files", "[io]")
+{
+    TempFile tmp(sampleBytes(1000) + "xyz");
+
+    SECTION("whole file mapped")
+    {
+        lazy::RecordFile<Sample> file(tmp.path);
+        REQUIRE(file.size() == 1000);
+        REQUIRE(file[999].time == 9990);
+        REQUIRE(file.end() - file.begin() == 1000);
+
+        auto f = lazy::filter(file.begin(), file.end(), [](const Sample& s){return s.sensor == 3 && s.time < 100;});
+        auto m = lazy::map(f.begin(), f.end(), [](const Sample& s){return s.value;});
+        io_check(m.begin(), m.end(), {1.5f, 3.5f});
+
+        auto values = lazy::project(file.begin(), file.end(), &Sample::value);
+        REQUIRE(&*values.begin() == &file[0].value);
+        auto sensors = lazy::project(file.begin(), file.end(), &Sample::sensor);
+        auto u = lazy::unique(sensors.begin(), sensors.end());
+        io_check(u.begin(), u.end(), {0u, 1u, 2u, 3u});
+    }
+
+    SECTION("sliding windows")
+    {
+        lazy::WindowedRecordFile<Sample> file(tmp.path, 4096);
+        REQUIRE(file.size() == 1000);
+
+        std::uint64_t sum = 0;
+        std::size_t count = 0;
+        for(auto it = file.begin(); it != file.end(); ++it, ++count)
+        {
+            REQUIRE(it->time == count * 10);
+            sum += it->time;
+            REQUIRE(file.mapped() <= 4096 + sizeof(Sample));
+        }
+        REQUIRE(count == 1000);
+        REQUIRE(sum == 4995000);
+
+        auto times = lazy::project(file.begin(), file.end(), &Sample::time);
+        auto f = lazy::filter(times.begin(), times.end(), [](std::uint64_t t){return t > 9970;});
+        io_check(f.begin(), f.end(), {std::uint64_t(9980), std::uint64_t(9990)});
+    }
+}
+
+TEST_CASE("csv reader", "[io]")
+{
+    std::string text = "id,name,price,amount\n"
+                       "1,apple,2.5,10\n"
+                       "2,\"pear, green\",1.25,3\r\n"
+                       "3,plum,4,0\n"
+                       "4,\"multi\nline\",0.5,7";
+
+    SECTION("in memory, all columns")
+    {
+        lazy::CsvOptions opts;
+        opts.header = true;
+        auto rows = lazy::csv(text, opts);
+        auto names = lazy::map(rows.begin(), rows.end(), [](const lazy::CsvRow& r){return std::string(r[1]);});
+        io_check(names.begin(), names.end(), {"apple", "pear, green", "plum", "multi\nline"});
+
+        auto rows2 = lazy::csv(text, opts);
+        auto it = rows2.begin();
+        REQUIRE(it->size() == 4);
+        REQUIRE(it->as<int>(0) == 1);
+        REQUIRE(it->as<double>(2) == 2.5);
+        REQUIRE_THROWS_AS(it->as<int>(1), const std::invalid_argument&);
+    }
+
+    SECTION("file with small buffer and projection")
+    {
+        TempFile tmp(text + "\n");
+        lazy::CsvOptions opts;
+        opts.header = true;
+        opts.columns = {3, 2};
+        opts.bufferSize = 16;
+
+        auto rows = lazy::csv_file(tmp.path, opts);
+        auto f = lazy::filter(rows.begin(), rows.end(), [](const lazy::CsvRow& r){return r.as<int>(0) > 0;});
+        auto m = lazy::map(f.begin(), f.end(), [](const lazy::CsvRow& r){return r.as<int>(0) * r.as<double>(1);});
+        io_check(m.begin(), m.end(), {25.0, 3.75, 3.5});
+
+        auto all = lazy::csv_file(tmp.path, opts);
+        for(const auto& row : all)
+            REQUIRE(row.size() == 2);
+    }
+
+    SECTION("rows longer than buffer")
+    {
+        // buffer of 64 bytes has to grow for each longer row, data kept from previous block survive it
+        std::string content;
+        for(int i = 0; i < 5; ++i)
+            content += std::to_string(i) + "," + std::string(150 + 40 * i, static_cast<char>('a' + i)) + "\n";
+        TempFile tmp(content);
+        lazy::CsvOptions opts;
+        opts.bufferSize = 64;
+
+        auto rows = lazy::csv_file(tmp.path, opts);
+        int n = 0;
+        for(const auto& row : rows)
+        {
+            REQUIRE(row.as<int>(0) == n);
+            REQUIRE(row[1] == std::string(150 + 40 * n, static_cast<char>('a' + n)));
+            ++n;
+        }
+        REQUIRE(n == 5);
+    }
+
+    SECTION("mapped file, other delimiter")
+    {
+        TempFile tmp("a;1\nb;2\n\nc;3\n");
+        lazy::MappedFile file(tmp.path);
+        lazy::CsvOptions opts;
+        opts.delimiter = ';';
+        auto rows = lazy::csv(file, opts);
+        auto m = lazy::map(rows.begin(), rows.end(), [](const lazy::CsvRow& r){return r[0];});
+        io_check(m.begin(), m.end(), {"a", "b", "", "c"});
+    }
+
+    SECTION("doubled quotes are unescaped")
+    {
+        std::string quoted = "\"a\"\"b\",plain,\"say \"\"hi\"\", \"\"bye\"\"\"\n"
+                             "\"1\"\"\"\"2\",x,\"\"\"7\"\"\"\n";
+        auto rows = lazy::csv(quoted);
+        auto it = rows.begin();
+        REQUIRE(it->size() == 3);
+        REQUIRE((*it)[0] == "a\"b");
+        REQUIRE((*it)[1] == "plain");
+        REQUIRE((*it)[2] == "say \"hi\", \"bye\"");
+        ++it;
+        REQUIRE((*it)[0] == "1\"\"2");
+        REQUIRE((*it)[2] == "\"7\"");
+
+        // projected columns only
+        lazy::CsvOptions opts;
+        opts.columns = {2};
+        auto projected = lazy::csv(quoted, opts);
+        auto m = lazy::map(projected.begin(), projected.end(), [](const lazy::CsvRow& r){return std::string(r[0]);});
+        io_check(m.begin(), m.end(), {"say \"hi\", \"bye\"", "\"7\""});
+    }
+
+    SECTION("unterminated quote at the end")
+    {
+        std::string broken = "1,ok\n2,\"never closed\n3,lost\n";
+        auto walk = [](auto& rows){
+            std::size_t n = 0;
+            for(auto it = rows.begin(); it != rows.end(); ++it)
+                ++n;
+            return n;
+        };
+        auto rows = lazy::csv(broken);
+        auto it = rows.begin();
+        REQUIRE((*it)[1] == "ok");
+        ++it;
+        REQUIRE_THROWS_AS(it != rows.end(), const std::runtime_error&);
+
+        TempFile tmp(broken);
+        lazy::CsvOptions opts;
+        opts.bufferSize = 4;
+        auto fileRows = lazy::csv_file(tmp.path, opts);
+        REQUIRE_THROWS_AS(walk(fileRows), const std::runtime_error&);
+    }
+}
+
+TEST_CASE("asynchronous file reader", "[io]")
+{
+    std::string content;
+    for(int i = 0; i < 5000; ++i)
+        content += std::to_string(i) + (i % 3 == 0 ? " fizz" : "") + "\n";
+    content += "last";
+    TempFile tmp(content);
+
+    SECTION("blocks")
+    {
+        auto blocks = lazy::async_blocks(tmp.path, 1000, 3);
+        std::string joined;
+        std::size_t count = 0;
+        for(auto it = blocks.begin(); it != blocks.end(); ++it, ++count)
+        {
+            REQUIRE(it->size() <= 1000);
+            joined.append(it->data(), it->size());
+        }
+        REQUIRE(joined == content);
+        REQUIRE(count == (content.size() + 999) / 1000);
+
+        auto sizes = lazy::async_blocks(tmp.path, content.size());
+        auto m = lazy::map(sizes.begin(), sizes.end(), [](std::string_view b){return b.size();});
+        io_check(m.begin(), m.end(), {content.size()});
+    }
+
+    SECTION("lines crossing blocks")
+    {
+        auto l = lazy::async_lines(tmp.path, 64, 2);
+        auto f = lazy::filter(l.begin(), l.end(), [](std::string_view line){return line.size() > 4 && line.substr(line.size() - 4) == "fizz";});
+        std::size_t fizz = 0;
+        for(auto it = f.begin(); it != f.end(); ++it)
+            ++fizz;
+        REQUIRE(fizz == 1667);
+
+        auto all = lazy::async_lines(tmp.path, 7);
+        std::size_t n = 0;
+        std::string lastLine;
+        for(auto it = all.begin(); it != all.end(); ++it, ++n)
+            lastLine = std::string(*it);
+        REQUIRE(n == 5001);
+        REQUIRE(lastLine == "last");
+    }
+
+    SECTION("empty file, early stop")
+    {
+        TempFile empty("");
+        auto e = lazy::async_lines(empty.path);
+        REQUIRE(e.begin() == e.end());
+
+        auto l = lazy::async_lines(tmp.path, 16, 2);
+        REQUIRE(*l.begin() == "0 fizz");
+    }
+}
+
+TEST_CASE("buffered sinks", "[io]")
+{
+    std::vector<int> data(10000);
+    for(int i = 0; i < 10000; ++i)
+        data[i] = i - 5000;
+
+    for(bool async : {false, true})
+    {
+        lazy::SinkOptions opts;
+        opts.bufferSize = 1000;
+        opts.async = async;
+
+        TempFile out("");
+        auto f = lazy::filter(data.begin(), data.end(), [](int x){return x % 7 == 0;});
+        REQUIRE(lazy::write_lines(f.begin(), f.end(), out.path, opts) == 1429);
+
+        lazy::MappedFile written(out.path);
+        auto parsed = lazy::lines(written);
+        auto m = lazy::map(parsed.begin(), parsed.end(), [](std::string_view line){
+            int value = 0;
+            std::from_chars(line.data(), line.data() + line.size(), value);
+            return value;
+        });
+        auto expected = lazy::filter(data.begin(), data.end(), [](int x){return x % 7 == 0;});
+        REQUIRE(std::equal(m.begin(), m.end(), expected.begin(), expected.end()));
+
+        TempFile bin("");
+        auto samples = lazy::map(data.begin(), data.end(), [](int x){return Sample{static_cast<std::uint32_t>(x & 3), x / 2.0f, static_cast<std::uint64_t>(x + 5000)};});
+        REQUIRE(lazy::write_binary(samples.begin(), samples.end(), bin.path, opts) == 10000);
+        lazy::RecordFile<Sample> records(bin.path);
+        REQUIRE(records.size() == 10000);
+        REQUIRE(records[1234].time == 1234);
+        REQUIRE(records[9999].value == 4999 / 2.0f);
+    }
+
+    SECTION("text of different types")
+    {
+        TempFile out("");
+        std::vector<std::string> words {"alpha", std::string(3000, 'x'), "", "omega"};
+        lazy::SinkOptions opts;
+        opts.bufferSize = 100;
+        lazy::write_lines(words.begin(), words.end(), out.path, opts);
+        lazy::MappedFile written(out.path);
+        REQUIRE(written.size() == 5 + 3000 + 0 + 5 + 4);
+
+        std::vector<double> doubles {0.5, -2.25, 1e300};
+        lazy::write_lines(doubles.begin(), doubles.end(), out.path);
+        lazy::MappedFile writtenDoubles(out.path);
+        REQUIRE(writtenDoubles.view() == "0.5\n-2.25\n1e+300\n");
+    }
+
+    SECTION("many asynchronous flushes")
+    {
+        // smallest buffer, thousands of hand-overs to the writer thread, long line bypasses the buffer
+        TempFile out("");
+        std::vector<std::string> words;
+        for(int i = 0; i < 20000; ++i)
+            words.push_back(i == 10000 ? std::string(500, 'y') : std::to_string(i));
+        lazy::SinkOptions opts;
+        opts.bufferSize = 1;
+        opts.async = true;
+        REQUIRE(lazy::write_lines(words.begin(), words.end(), out.path, opts) == 20000);
+
+        lazy::MappedFile written(out.path);
+        auto parsed = lazy::lines(written);
+        REQUIRE(std::equal(parsed.begin(), parsed.end(), words.begin(), words.end()));
+    }
+}
+
+#endif
@@ -0,0 +1,442 @@
+#include "catch.hpp"
+#include "lazy.h"
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+template<typename I, typename T>
+void s_check(I first, I last, std::initializer_list<T> expected)
+{
+    bool res = std::equal(first, last, expected.begin(), expected.end());
+    REQUIRE(res);
+}
+
+/**
+ * Result type which can be neither copied nor default constructed
+ */
+struct MoveOnlyBox
+{
+    std::unique_ptr<int> value;
+
+    explicit MoveOnlyBox(int x) : value(std::make_unique<int>(x)) {}
+    MoveOnlyBox(MoveOnlyBox&&) = default;
+    MoveOnlyBox& operator=(MoveOnlyBox&&) = default;
+};
+
+}
+
+TEST_CASE("move-only results", "[stages]")
+{
+    std::vector<int> data {1, 2, 3, 4};
+
+    SECTION("map")
+    {
+        auto m = lazy::map(data.begin(), data.end(), [](int x){return std::make_unique<int>(x*2);});
+
+        auto it = m.begin();
+        REQUIRE(**it == 2);
+        auto copy = it;
+        REQUIRE(**copy == 2);
+        REQUIRE(**(it++) == 2);
+        REQUIRE(**it == 4);
+
+        std::vector<std::unique_ptr<int>> taken;
+        for(auto i = m.begin(); i != m.end(); ++i)
+            taken.push_back(i.take());
+        REQUIRE(taken.size() == 4);
+        REQUIRE(*taken[3] == 8);
+
+        auto moved = std::move(it);
+        REQUIRE(**moved == 4);
+    }
+
+    SECTION("zip")
+    {
+        auto z = lazy::zip(data.begin(), data.end(), data.begin(), data.end(),
+                           [](int x, int y){return MoveOnlyBox(x*y);});
+        auto it = z.begin();
+        REQUIRE(*it->value == 1);
+        ++it;
+        REQUIRE(*(it++)->value == 4);
+        REQUIRE(*it.take().value == 9);
+        REQUIRE(*(*it).value == 9);
+
+        auto m = lazy::map(z.begin(), z.end(), [](const MoveOnlyBox& b){return *b.value + 1;});
+        s_check(m.begin(), m.end(), {2, 5, 10, 17});
+    }
+}
+
+TEST_CASE("map_into", "[stages]")
+{
+    std::vector<std::string> words {"hi", "hello", "world", "a"};
+
+    SECTION("deduced result")
+    {
+        auto m = lazy::map_into(words.begin(), words.end(), [](const std::string& w, std::string& out) {
+            out.assign(w);
+            out += " ";
+            out += std::to_string(w.size());
+        });
+        s_check(m.begin(), m.end(), {"hi 2", "hello 5", "world 5", "a 1"});
+
+        // Buffer of the cached result is reused once it is big enough
+        // (results are longer than small string buffer, so they live on the heap)
+        std::vector<std::string> longWords {"a first word which is rather long, longer than the next", "second word, too long to be inline"};
+        auto l = lazy::map_into(longWords.begin(), longWords.end(), [](const std::string& w, std::string& out) {
+            out.assign(w);
+            out += " and the same again: ";
+            out += w;
+        });
+        auto it = l.begin();
+        REQUIRE(it->size() > 2 * longWords[0].size());
+        const char* buffer = it->data();
+        auto capacity = it->capacity();
+        REQUIRE(capacity > std::string().capacity());
+        ++it;
+        REQUIRE(*it == longWords[1] + " and the same again: " + longWords[1]);
+        REQUIRE(it->capacity() == capacity);
+        REQUIRE(it->data() == buffer);
+
+        // postfix ++ keeps the buffer in the iterator
+        auto post = l.begin();
+        buffer = post->data();
+        auto previous = post++;
+        REQUIRE(*previous == longWords[0] + " and the same again: " + longWords[0]);
+        REQUIRE(*post == longWords[1] + " and the same again: " + longWords[1]);
+        REQUIRE(post->data() == buffer);
+        REQUIRE(*post++ == longWords[1] + " and the same again: " + longWords[1]);
+        REQUIRE(post == l.end());
+    }
+
+    SECTION("explicit result, chained")
+    {
+        auto m = lazy::map_into<std::vector<char>>(words.begin(), words.end(), [](const auto& w, auto& out) {
+            out.assign(w.rbegin(), w.rend());
+        });
+        auto f = lazy::filter(m.begin(), m.end(), [](const std::vector<char>& v){return v.size() == 5;});
+        auto s = lazy::map(f.begin(), f.end(), [](const std::vector<char>& v){return std::string(v.begin(), v.end());});
+        s_check(s.begin(), s.end(), {"olleh", "dlrow"});
+
+        auto tmp = m.begin();
+        REQUIRE((tmp++)->size() == 2);
+        REQUIRE(tmp->size() == 5);
+        REQUIRE(++tmp != m.end());
+    }
+}
+
+TEST_CASE("variadic zip", "[stages]")
+{
+    // Struct-of-arrays columns
+    std::vector<int> ids {1, 2, 3, 4};
+    std::vector<double> prices {2.5, 1.0, 4.0, 0.5};
+    std::vector<int> amounts {2, 10, 1, 4};
+    const std::vector<std::string> names {"a", "b", "c"};
+
+    SECTION("tuples of references")
+    {
+        auto z = lazy::zip(ids, prices, amounts, names);
+        REQUIRE(std::distance(z.begin(), z.end()) == 3);
+
+        auto it = z.begin();
+        REQUIRE(std::get<0>(*it) == 1);
+        REQUIRE(&std::get<1>(*it) == &prices[0]);
+        REQUIRE(std::get<3>(*it) == "a");
+
+        for(auto row : z)
+            std::get<2>(row) *= 2;
+        REQUIRE(amounts[2] == 2);
+        REQUIRE(amounts[3] == 4);
+
+        auto f = lazy::filter(z.begin(), z.end(), [](const auto& row){return std::get<1>(row) > 2;});
+        auto m = lazy::map(f.begin(), f.end(), [](const auto& row){return std::get<3>(row);});
+        s_check(m.begin(), m.end(), {"a", "c"});
+    }
+
+    SECTION("n-ary function")
+    {
+        auto total = lazy::zip([](double price, int amount, int id){return price * amount + id;}, prices, amounts, ids);
+        s_check(total.begin(), total.end(), {6.0, 12.0, 7.0, 6.0});
+
+        auto lazyIds = lazy::map(ids.begin(), ids.end(), [](int id){return id * 10;});
+        auto z = lazy::zip([](int a, int b){return a + b;}, lazyIds, ids);
+        s_check(z.begin(), z.end(), {11, 22, 33, 44});
+    }
+
+    SECTION("old zip is still selected for iterators")
+    {
+        auto z = lazy::zip(ids.begin(), ids.end(), amounts.begin(), amounts.end(), [](int a, int b){return a * b;});
+        s_check(z.begin(), z.end(), {2, 20, 3, 16});
+    }
+}
+
+namespace
+{
+struct Record
+{
+    int id;
+    double price;
+    std::string name;
+};
+}
+
+TEST_CASE("columnar container", "[stages]")
+{
+    std::vector<Record> records {{1, 2.5, "a"}, {2, 10.0, "b"}, {3, 0.5, "c"}, {4, 7.0, "d"}};
+
+    auto cols = lazy::columnar(records.begin(), records.end(), &Record::id, &Record::price, &Record::name);
+    REQUIRE(cols.size() == 4);
+    REQUIRE(cols.data<1>()[1] == 10.0);
+
+    SECTION("columns")
+    {
+        auto prices = cols.column<1>();
+        auto f = lazy::filter(prices.begin(), prices.end(), [](double p){return p > 2;});
+        s_check(f.begin(), f.end(), {2.5, 10.0, 7.0});
+
+        auto z = lazy::zip([](int id, const std::string& name){return name + std::to_string(id);}, cols.column<0>(), cols.column<2>());
+        s_check(z.begin(), z.end(), {"a1", "b2", "c3", "d4"});
+
+        auto ids = cols.column<0>();
+        auto m = lazy::map(ids.begin(), ids.end(), [](int id){return id * id;});
+        s_check(m.begin(), m.end(), {1, 4, 9, 16});
+    }
+
+    SECTION("rows")
+    {
+        for(auto row : cols)
+            std::get<1>(row) *= 2;
+        REQUIRE(cols.data<1>()[3] == 14.0);
+
+        const auto& constCols = cols;
+        auto f = lazy::filter(constCols.begin(), constCols.end(), [](const auto& row){return std::get<1>(row) < 10;});
+        auto m = lazy::map(f.begin(), f.end(), [](const auto& row){return std::get<2>(row);});
+        s_check(m.begin(), m.end(), {"a", "c"});
+
+        cols.push_back(5, 1.0, "e");
+        REQUIRE(std::get<2>(*std::next(cols.begin(), 4)) == "e");
+        cols.clear();
+        REQUIRE(cols.empty());
+        REQUIRE(cols.begin() == cols.end());
+    }
+}
+
+TEST_CASE("cached selection", "[stages]")
+{
+    std::vector<int> data {5, 1, 2, 5, 3, 2, 8, 1};
+
+    SECTION("filter")
+    {
+        int calls = 0;
+        auto f = lazy::filter(data.begin(), data.end(), [&calls](int x){++calls; return x % 2 == 0;});
+        auto c = lazy::cache_selection(f.begin(), f.end());
+
+        s_check(c.begin(), c.end(), {2, 2, 8});
+        int firstPass = calls;
+        s_check(c.begin(), c.end(), {2, 2, 8});
+        s_check(c.begin(), c.end(), {2, 2, 8});
+        REQUIRE(calls == firstPass);
+        REQUIRE(c.begin().recorded() == 3);
+
+        auto it = c.begin();
+        REQUIRE(&*it == &data[2]);
+        REQUIRE(*(++it) == 2);
+        REQUIRE(*(it++) == 2);
+        REQUIRE(*it == 8);
+        REQUIRE(++it == c.end());
+    }
+
+    SECTION("unique, partial first pass")
+    {
+        auto u = lazy::unique(data.begin(), data.end());
+        auto c = lazy::cache_selection(u.begin(), u.end());
+
+        REQUIRE(*c.begin() == 5);
+        REQUIRE(*std::next(c.begin(), 2) == 2);
+        s_check(c.begin(), c.end(), {5, 1, 2, 3, 8});
+        s_check(c.begin(), c.end(), {5, 1, 2, 3, 8});
+
+        auto e = lazy::filter(data.begin(), data.end(), [](int x){return x > 10;});
+        auto ce = lazy::cache_selection(e.begin(), e.end());
+        REQUIRE(ce.begin() == ce.end());
+    }
+
+    SECTION("lazy base is replayed, not stored per element")
+    {
+        int calls = 0;
+        auto m = lazy::map(data.begin(), data.end(), [&calls](int x){++calls; return x * 10;});
+        auto f = lazy::filter(m.begin(), m.end(), [](int x){return x > 20;});
+        auto c = lazy::cache_selection(f.begin(), f.end());
+
+        s_check(c.begin(), c.end(), {50, 50, 30, 80});
+        int firstPass = calls;
+        s_check(c.begin(), c.end(), {50, 50, 30, 80});
+        // skipped elements are only stepped over
+        REQUIRE(calls - firstPass <= 4);
+
+        std::vector<int> big(1000, 7);
+        auto bm = lazy::map(big.begin(), big.end(), [](int x){return x;});
+        auto bf = lazy::filter(bm.begin(), bm.end(), [](int x){return x > 0;});
+        auto bc = lazy::cache_selection(bf.begin(), bf.end());
+        REQUIRE(std::distance(bc.begin(), bc.end()) == 1000);
+        // offsets instead of copies of underlying iterators
+        REQUIRE(bc.begin().memory_usage() < 1000 * sizeof(bm.begin()));
+    }
+}
+
+TEST_CASE("cache", "[stages]")
+{
+    SECTION("input iterator replay")
+    {
+        std::istringstream str("4 1 3 2");
+        int calls = 0;
+        auto m = lazy::map(std::istream_iterator<int>(str), std::istream_iterator<int>(), [&calls](int x){++calls; return x * 10;});
+        auto c = lazy::cache(m.begin(), m.end());
+
+        REQUIRE(*c.begin() == 40);
+        REQUIRE(c.begin().buffered() == 1);
+        s_check(c.begin(), c.end(), {40, 10, 30, 20});
+        s_check(c.begin(), c.end(), {40, 10, 30, 20});
+        REQUIRE(calls == 4);
+
+        auto u = lazy::unique(c.begin(), c.end());
+        s_check(u.begin(), u.end(), {40, 10, 30, 20});
+    }
+
+    SECTION("random access")
+    {
+        std::vector<int> data {3, 1, 2};
+        auto c = lazy::cache(data.begin(), data.end());
+
+        REQUIRE(c.end() - c.begin() == 3);
+        REQUIRE(c.begin()[2] == 2);
+        REQUIRE(*(c.end() - 1) == 2);
+        REQUIRE(c.begin() < c.end());
+
+        std::vector<int> sorted(c.begin(), c.end());
+        std::sort(sorted.begin(), sorted.end());
+        REQUIRE(sorted == std::vector<int>({1, 2, 3}));
+        REQUIRE(*std::max_element(c.begin(), c.end()) == 3);
+        REQUIRE(std::binary_search(sorted.begin(), sorted.end(), c.begin()[1]));
+    }
+}
+
+TEST_CASE("tee", "[stages]")
+{
+    std::istringstream str("1 2 2 3 4 4 5");
+    auto t = lazy::tee(std::istream_iterator<int>(str), std::istream_iterator<int>(), 3);
+    REQUIRE(t.size() == 3);
+
+    auto count = t[0].begin();
+    auto u = lazy::unique(t[1].begin(), t[1].end());
+    auto f = lazy::filter(t[2].begin(), t[2].end(), [](int x){return x % 2 == 0;});
+
+    auto uIt = u.begin();
+    auto fIt = f.begin();
+    std::vector<int> distinct, even;
+    int n = 0;
+    // Consumers advance at different pace, window holds only the gap between them
+    for(; count != t[0].end(); ++count)
+    {
+        ++n;
+        if(n % 2 == 0 && uIt != u.end())
+            distinct.push_back(*uIt++);
+        REQUIRE(count.buffered() <= 7);
+    }
+    for(; uIt != u.end(); ++uIt)
+        distinct.push_back(*uIt);
+    for(; fIt != f.end(); ++fIt)
+        even.push_back(*fIt);
+
+    REQUIRE(n == 7);
+    REQUIRE(distinct == std::vector<int>({1, 2, 3, 4, 5}));
+    REQUIRE(even == std::vector<int>({2, 2, 4, 4}));
+    // only the last element, which consumers may still read through copies made by postfix ++
+    REQUIRE(count.buffered() == 1);
+}
+
+TEST_CASE("tee memory follows the gap", "[stages]")
+{
+    std::vector<int> data;
+    for(int i = 0; i < 2000; ++i)
+        data.push_back(i);
+
+    // leader runs away from follower, then follower catches up and passes it
+    auto t = lazy::tee(data.begin(), data.end(), 2);
+    auto leader = t[0].begin();
+    auto follower = t[1].begin();
+    std::size_t leaderPos = 0, followerPos = 0;
+    std::size_t maxBuffered = 0;
+    while(leader != t[0].end() || follower != t[1].end())
+    {
+        bool leaderSteps = leaderPos < 1000 || followerPos >= 1500;
+        if(leaderSteps && leader != t[0].end())
+        {
+            REQUIRE(*leader == static_cast<int>(leaderPos));
+            ++leader;
+            ++leaderPos;
+        }
+        if((!leaderSteps || leaderPos % 2 == 0) && follower != t[1].end())
+        {
+            REQUIRE(*follower == static_cast<int>(followerPos));
+            ++follower;
+            ++followerPos;
+        }
+        std::size_t gap = leaderPos > followerPos ? leaderPos - followerPos : followerPos - leaderPos;
+        REQUIRE(leader.buffered() <= gap + 1);
+        maxBuffered = std::max(maxBuffered, leader.buffered());
+    }
+    REQUIRE(leaderPos == 2000);
+    REQUIRE(followerPos == 2000);
+    // the gap grew to 500 elements, then the window shrank again
+    REQUIRE(maxBuffered >= 500);
+    REQUIRE(leader.buffered() <= 1);
+}
+
+TEST_CASE("tee window", "[stages]")
+{
+    std::vector<int> data(100);
+    auto t = lazy::tee(data.begin(), data.end(), 2);
+    auto a = t[0].begin();
+    auto b = t[1].begin();
+    for(int i = 0; i < 100; ++i)
+    {
+        REQUIRE(*a == 0);
+        REQUIRE(*b == 0);
+        ++a;
+        ++b;
+        REQUIRE(a.buffered() <= 1);
+    }
+    REQUIRE(a == t[0].end());
+    REQUIRE(b == t[1].end());
+}
+
+TEST_CASE("tee postfix increment", "[stages]")
+{
+    std::vector<int> data;
+    for(int i = 0; i < 1000; ++i)
+        data.push_back(i);
+
+    // single consumer releases elements right after passing them, copy returned by it++
+    // still reads the element it points to after the original moved on
+    auto t = lazy::tee(data.begin(), data.end(), 1);
+    std::vector<int> first;
+    for(auto it = t[0].begin(); it != t[0].end(); )
+        first.push_back(*it++);
+    REQUIRE(first == data);
+
+    auto u = lazy::tee(data.begin(), data.end(), 1);
+    std::vector<int> second;
+    std::copy(u[0].begin(), u[0].end(), std::back_inserter(second));
+    REQUIRE(second == data);
+
+    // consumer range is single-pass, released elements cannot be read again
+    auto again = u[0].begin();
+    REQUIRE_THROWS_AS(*again, const std::logic_error&);
+}
@@ -0,0 +1,461 @@
+#include "catch.hpp"
+#include "lazy.h"
+#include "lazyAsync.h"
+#include "lazyHistogram.h"
+#include "lazyTrace.h"
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+std::size_t st_count(const std::string& text, const std::string& pattern)
+{
+    std::size_t count = 0;
+    for(auto pos = text.find(pattern); pos != std::string::npos; pos = text.find(pattern, pos + 1))
+        ++count;
+    return count;
+}
+
+/**
+ * Microseconds with 3 decimal places written by trace as nanoseconds
+ */
+std::uint64_t st_nanos(const std::string& text, std::size_t pos)
+{
+    std::size_t dot = text.find('.', pos);
+    return std::stoull(text.substr(pos, dot - pos)) * 1000 + std::stoull(text.substr(dot + 1, 3));
+}
+
+/**
+ * Start and end (in nanoseconds) of every async span (begin/end pair) with given name in trace JSON
+ */
+std::vector<std::pair<std::uint64_t, std::uint64_t>> st_spans(const std::string& json, const std::string& name)
+{
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> spans;
+    auto pattern = "\"name\": \"" + name + "\"";
+    for(auto pos = json.find(pattern); pos != std::string::npos; pos = json.find(pattern, pos + 1))
+    {
+        auto ts = st_nanos(json, json.find("\"ts\": ", pos) + 6);
+        if(json.compare(json.find("\"ph\": ", pos) + 6, 3, "\"b\"") == 0)
+            spans.emplace_back(ts, 0);
+        else
+            spans.back().second = ts;
+    }
+    return spans;
+}
+
+}
+
+TEST_CASE("stage statistics", "[stats]")
+{
+    std::vector<int> data {1, 2, 3, 4, 5, 6, 2, 4};
+
+    SECTION("disabled policy has no size")
+    {
+        REQUIRE(sizeof(lazy::MapIt<int*, int>) == sizeof(lazy::MapIt<int*, int, lazy::NoStats>));
+        REQUIRE(sizeof(lazy::MapIt<int*, int>) < sizeof(lazy::MapIt<int*, int, lazy::Counting>));
+        REQUIRE(sizeof(lazy::FilterIt<int*>) < sizeof(lazy::FilterIt<int*, lazy::Counting>));
+    }
+
+    SECTION("map")
+    {
+        lazy::StageStats stats;
+        auto m = lazy::map(data.begin(), data.end(), [](int x){return x * 2;}, lazy::Counting(stats));
+        int sum = 0;
+        for(auto it = m.begin(); it != m.end(); ++it)
+            sum += *it + *it;
+        REQUIRE(sum == 108);
+        REQUIRE(stats.pulled == data.size());
+        REQUIRE(stats.yielded == data.size());
+        REQUIRE(stats.calls == data.size());
+        REQUIRE(stats.cacheHits == data.size());
+    }
+
+    SECTION("default constructed policy counts nothing")
+    {
+        auto m = lazy::map(data.begin(), data.end(), [](int x){return x * 2;}, lazy::Counting());
+        auto f = lazy::filter(m.begin(), m.end(), [](int x){return x > 4;}, lazy::Timing());
+        auto u = lazy::unique(f.begin(), f.end(), lazy::Counting());
+        int sum = 0;
+        for(auto it = u.begin(); it != u.end(); ++it)
+            sum += *it;
+        REQUIRE(sum == 6 + 8 + 10 + 12);
+    }
+
+    SECTION("partially consumed map and zip")
+    {
+        lazy::StageStats mapStats, zipStats;
+        auto m = lazy::map(data.begin(), data.end(), [](int x){return x * 2;}, lazy::Counting(mapStats));
+        auto it = m.begin();
+        int sum = 0;
+        for(int i = 0; i < 3; ++i, ++it)
+            sum += *it;
+        // stepped over without reading
+        ++it;
+        ++it;
+        REQUIRE(sum == 12);
+        REQUIRE(mapStats.pulled == 3);
+        REQUIRE(mapStats.yielded == 3);
+        REQUIRE(mapStats.calls == 3);
+
+        auto z = lazy::zip(data.begin(), data.end(), data.begin(), data.end(), [](int x, int y){return x * y;}, lazy::Counting(zipStats));
+        auto zIt = z.begin();
+        REQUIRE(*zIt == 1);
+        REQUIRE(*zIt == 1);
+        std::advance(zIt, 4);
+        REQUIRE(*zIt == 25);
+        REQUIRE(zipStats.pulled == 2);
+        REQUIRE(zipStats.yielded == 2);
+        REQUIRE(zipStats.calls == 2);
+        REQUIRE(zipStats.cacheHits == 1);
+    }
+
+    SECTION("filter and zip")
+    {
+        lazy::StageStats filterStats, zipStats;
+        auto f = lazy::filter(data.begin(), data.end(), [](int x){return x % 2 == 0;}, lazy::Counting(filterStats));
+        auto z = lazy::zip(f.begin(), f.end(), data.begin(), data.end(), [](int x, int y){return x + y;}, lazy::Timing(zipStats));
+        std::vector<int> result;
+        for(auto it = z.begin(); it != z.end(); ++it)
+            result.push_back(*it);
+
+        REQUIRE(result == std::vector<int>({3, 6, 9, 6, 9}));
+        REQUIRE(filterStats.pulled == data.size());
+        REQUIRE(filterStats.calls == data.size());
+        REQUIRE(filterStats.yielded == 5);
+        REQUIRE(zipStats.calls == 5);
+        REQUIRE(zipStats.yielded == 5);
+        REQUIRE(zipStats.ticks > 0);
+    }
+
+    SECTION("unique")
+    {
+        lazy::StageStats stats;
+        auto u = lazy::unique(data.begin(), data.end(), lazy::Counting(stats));
+        std::vector<int> result;
+        for(auto it = u.begin(); it != u.end(); ++it)
+            result.push_back(*it);
+
+        REQUIRE(result == std::vector<int>({1, 2, 3, 4, 5, 6}));
+        REQUIRE(stats.pulled == data.size());
+        REQUIRE(stats.yielded == 6);
+        REQUIRE(stats.setSize == 6);
+        REQUIRE(stats.probes >= 2);
+    }
+}
+
+TEST_CASE("chrome trace", "[stats]")
+{
+    std::vector<int> data {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    lazy::trace::clear();
+    lazy::trace::enable();
+
+    {
+        auto m = lazy::map(data.begin(), data.end(), [](int x){return x * 2;}, lazy::Traced("double", 4));
+        auto s = lazy::stage(m.begin(), m.end(), 3, 2, "producer");
+        int sum = 0;
+        for(auto it = s.begin(); it != s.end(); ++it)
+            sum += *it;
+        REQUIRE(sum == 110);
+    }
+
+    lazy::trace::disable();
+    {
+        // nothing is recorded when tracing is disabled
+        auto m = lazy::map(data.begin(), data.end(), [](int x){return x;}, lazy::Traced("disabled"));
+        for(auto it = m.begin(); it != m.end(); ++it)
+            *it;
+    }
+
+    std::ostringstream out;
+    lazy::trace::write(out);
+    auto json = out.str();
+    lazy::trace::clear();
+
+    REQUIRE(json.find("{\"traceEvents\": [") == 0);
+    // chunks of 4, 4 and 2 calls, each is begin/end pair
+    REQUIRE(st_count(json, "\"name\": \"double\"") == 6);
+    REQUIRE(st_count(json, "\"ph\": \"b\"") == 3);
+    REQUIRE(st_count(json, "\"ph\": \"e\"") == 3);
+    REQUIRE(st_count(json, "\"elements\": 2}") >= 1);
+    // batches of 3, 3, 3 and 1 elements
+    REQUIRE(st_count(json, "\"name\": \"producer\"") == 4);
+    REQUIRE(st_count(json, "\"name\": \"disabled\"") == 0);
+    REQUIRE(st_count(json, "\"ph\": \"X\"") == 4);
+
+    // timestamps keep nanosecond precision late in the run
+    lazy::trace::Recorder::instance().record({"late", "test", 1500123456, 1234, 1});
+    std::ostringstream late;
+    lazy::trace::write(late);
+    lazy::trace::clear();
+    REQUIRE(late.str().find("\"ts\": 1500123.456, \"dur\": 1.234,") != std::string::npos);
+}
+
+TEST_CASE("trace spans of chained stages", "[stats]")
+{
+    std::vector<int> data;
+    for(int i = 0; i < 1000; ++i)
+        data.push_back(i);
+    auto slow = [](int x){
+        std::this_thread::sleep_for(std::chrono::microseconds(20));
+        return x;
+    };
+    auto& recorder = lazy::trace::Recorder::instance();
+    lazy::trace::clear();
+    lazy::trace::enable();
+    auto before = recorder.now();
+    {
+        auto f = lazy::filter(data.begin(), data.end(), [&](int x){return slow(x) % 2 == 0;}, lazy::Traced("even", 16));
+        auto m = lazy::map(f.begin(), f.end(), [&](int x){return slow(x) + 1;}, lazy::Traced("inc", 16));
+        long sum = 0;
+        for(auto it = m.begin(); it != m.end(); ++it)
+            sum += *it;
+        REQUIRE(sum == 250000);
+    }
+    auto after = recorder.now();
+    lazy::trace::disable();
+
+    std::ostringstream out;
+    lazy::trace::write(out);
+    lazy::trace::clear();
+
+    auto even = st_spans(out.str(), "even");
+    auto inc = st_spans(out.str(), "inc");
+    REQUIRE(even.size() >= 63);
+    REQUIRE(inc.size() >= 32);
+
+    // spans keep the real time of their chunks, every call of the stage lies inside one of them
+    std::uint64_t evenTotal = 0;
+    for(const auto& span : even)
+    {
+        REQUIRE(span.first >= before);
+        REQUIRE(span.second <= after);
+        evenTotal += span.second - span.first;
+    }
+    std::uint64_t incTotal = 0;
+    for(const auto& span : inc)
+    {
+        REQUIRE(span.first >= before);
+        REQUIRE(span.second <= after);
+        incTotal += span.second - span.first;
+    }
+    REQUIRE(evenTotal >= 1000 * 20000);
+    REQUIRE(incTotal >= 500 * 20000);
+}
+
+TEST_CASE("trace buffers of finished threads", "[stats]")
+{
+    std::vector<int> data {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    auto& recorder = lazy::trace::Recorder::instance();
+    lazy::trace::clear();
+    lazy::trace::enable();
+
+    // every stage runs its own producer thread, buffer of the finished one is reused by the next
+    auto buffers = recorder.buffers();
+    for(int i = 0; i < 50; ++i)
+    {
+        auto s = lazy::stage(data.begin(), data.end(), 3, 2, "producer");
+        int sum = 0;
+        for(auto it = s.begin(); it != s.end(); ++it)
+            sum += *it;
+        REQUIRE(sum == 55);
+        REQUIRE(recorder.buffers() <= buffers + 1);
+    }
+    lazy::trace::disable();
+
+    std::ostringstream out;
+    lazy::trace::write(out);
+    lazy::trace::clear();
+    // events of all threads are kept
+    REQUIRE(st_count(out.str(), "\"name\": \"producer\"") == 50 * 4);
+}
+
+TEST_CASE("latency histograms", "[stats]")
+{
+    SECTION("buckets")
+    {
+        lazy::LatencyHistogram hist;
+        for(std::uint64_t i = 1; i <= 1000; ++i)
+            hist.record(i * 1000);
+
+        REQUIRE(hist.count() == 1000);
+        REQUIRE(hist.min() == 1000);
+        REQUIRE(hist.max() == 1000000);
+        REQUIRE(hist.mean() == Approx(500500));
+        // reported value is at most 1/16 above the exact one
+        REQUIRE(hist.percentile(50) >= 500000);
+        REQUIRE(hist.percentile(50) <= 500000 + 500000 / 16);
+        REQUIRE(hist.percentile(99) >= 990000);
+        REQUIRE(hist.percentile(99) <= 990000 + 990000 / 16);
+        REQUIRE(hist.percentile(100) == 1000000);
+
+        for(std::uint64_t v : {0ull, 7ull, 16ull, 1000ull, 123456789ull, ~0ull})
+            REQUIRE(lazy::LatencyHistogram::bucketUpper(lazy::LatencyHistogram::bucketIndex(v)) >= v);
+    }
+
+    SECTION("sampled map")
+    {
+        lazy::LatencyHistogram hist;
+        std::vector<int> data(100, 1);
+        auto m = lazy::map(data.begin(), data.end(), [](int x){return x + 1;}, lazy::Sampled(hist, 10));
+        int sum = 0;
+        for(auto it = m.begin(); it != m.end(); ++it)
+            sum += *it;
+        REQUIRE(sum == 200);
+        REQUIRE(hist.count() == 10);
+
+        // policy without histogram times nothing
+        auto plain = lazy::map(data.begin(), data.end(), [](int x){return x + 2;}, lazy::Sampled());
+        sum = 0;
+        for(auto it = plain.begin(); it != plain.end(); ++it)
+            sum += *it;
+        REQUIRE(sum == 300);
+        auto u = lazy::unique(data.begin(), data.end(), lazy::Sampled());
+        REQUIRE(std::distance(u.begin(), u.end()) == 1);
+    }
+
+    SECTION("slow predicate calls show in tail")
+    {
+        lazy::LatencyHistogram hist;
+        std::vector<int> data(50, 0);
+        data[10] = 1;
+        auto f = lazy::filter(data.begin(), data.end(), [](int x){
+            if(x)
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            return x == 0;
+        }, lazy::Sampled(hist));
+        std::size_t n = 0;
+        for(auto it = f.begin(); it != f.end(); ++it)
+            ++n;
+
+        REQUIRE(n == 49);
+        REQUIRE(hist.count() == 50);
+        REQUIRE(hist.percentile(100) >= 2000000);
+        REQUIRE(hist.percentile(50) < 2000000);
+    }
+}
+
+TEST_CASE("memory usage", "[stats]")
+{
+    std::vector<int> data;
+    for(int i = 0; i < 10000; ++i)
+        data.push_back(i % 5000);
+
+    SECTION("stages report their state and state of stages they read from")
+    {
+        auto f = lazy::filter(data.begin(), data.end(), [](int x){return x % 2 == 0;});
+        auto m = lazy::map(f.begin(), f.end(), [](int x){return std::to_string(x);});
+        auto it = m.begin();
+        auto before = it.memory_usage();
+        *it;
+        REQUIRE(it.memory_usage() == before + sizeof(std::string));
+        REQUIRE(it.memory_usage() > f.begin().memory_usage());
+
+        // heap payload of cached results counts
+        std::vector<int> one {1};
+        auto big = lazy::map(one.begin(), one.end(), [](int){return std::string(1 << 20, 'x');});
+        auto bigIt = big.begin();
+        *bigIt;
+        REQUIRE(bigIt.memory_usage() > (1 << 20));
+        auto bigInto = lazy::map_into<std::string>(one.begin(), one.end(), [](int, std::string& out){out.assign(1 << 20, 'x');});
+        auto bigIntoIt = bigInto.begin();
+        *bigIntoIt;
+        REQUIRE(bigIntoIt.memory_usage() > (1 << 20));
+        auto bigZip = lazy::zip(one.begin(), one.end(), one.begin(), one.end(), [](int, int){return std::vector<char>(1 << 20);});
+        auto bigZipIt = bigZip.begin();
+        *bigZipIt;
+        REQUIRE(bigZipIt.memory_usage() > (1 << 20));
+
+        auto c = lazy::cache(data.begin(), data.end());
+        auto cIt = c.begin();
+        auto empty = cIt.memory_usage();
+        std::advance(cIt, 100);
+        REQUIRE(*cIt == 100);
+        REQUIRE(cIt.memory_usage() >= empty + 100 * sizeof(int));
+    }
+
+    SECTION("unique set")
+    {
+        auto u = lazy::unique(data.begin(), data.end());
+        auto it = u.begin();
+        auto start = it.memory_usage();
+        std::size_t n = 0;
+        for(; it != u.end(); ++it)
+            ++n;
+        REQUIRE(n == 5000);
+        REQUIRE(it.memory_usage() > start + 5000 * sizeof(int));
+    }
+
+    SECTION("budget fails fast")
+    {
+        auto u = lazy::unique(data.begin(), data.end(), lazy::MemoryBudget(16 * 1024));
+        auto walk = [&u]{
+            for(auto it = u.begin(); it != u.end(); ++it);
+        };
+        REQUIRE_THROWS_AS(walk(), const lazy::MemoryBudgetExceeded&);
+    }
+
+    SECTION("budget switches to pass-through")
+    {
+        std::size_t budget = 16 * 1024;
+        auto u = lazy::unique(data.begin(), data.end(), lazy::MemoryBudget(budget, lazy::MemoryBudget::PassThrough));
+        auto it = u.begin();
+        std::size_t n = 0;
+        for(; it != u.end(); ++it)
+            ++n;
+        // values seen after the set was full are not remembered, so their duplicates pass again
+        REQUIRE(n > 5000);
+        REQUIRE(n <= data.size());
+        REQUIRE(it.memory_usage() <= budget);
+    }
+
+    SECTION("heap payload of strings counts")
+    {
+        std::vector<std::string> words;
+        for(int i = 0; i < 1000; ++i)
+            words.push_back(std::string(200, 'a') + std::to_string(i));
+
+        auto u = lazy::unique(words.begin(), words.end());
+        auto it = u.begin();
+        for(; it != u.end(); ++it);
+        REQUIRE(it.memory_usage() > 1000 * 200);
+
+        // nodes alone would fit into the budget, strings do not
+        std::size_t budget = 100 * 1000;
+        REQUIRE(1000 * (sizeof(std::string) + 2 * sizeof(void*)) < budget);
+        auto limited = lazy::unique(words.begin(), words.end(), lazy::MemoryBudget(budget));
+        auto walk = [&limited]{
+            for(auto it = limited.begin(); it != limited.end(); ++it);
+        };
+        REQUIRE_THROWS_AS(walk(), const lazy::MemoryBudgetExceeded&);
+    }
+
+    SECTION("cache and tee budgets")
+    {
+        std::size_t budget = 1000 * sizeof(int);
+        auto c = lazy::cache(data.begin(), data.end(), lazy::MemoryBudget(budget));
+        auto cIt = c.begin();
+        std::advance(cIt, 500);
+        REQUIRE(*cIt == 500);
+        REQUIRE_THROWS_AS(cIt[600], const lazy::MemoryBudgetExceeded&);
+        // buffered part stays usable
+        REQUIRE(c.begin()[999] == 999);
+        REQUIRE(cIt.memory_usage() <= budget + 1024);
+
+        auto t = lazy::tee(data.begin(), data.end(), 2, lazy::MemoryBudget(budget));
+        auto fast = t[0].begin();
+        auto slow = t[1].begin();
+        // consumers at the same pace need only few elements
+        for(int i = 0; i < 5000; ++i, ++fast, ++slow)
+            REQUIRE(*fast == *slow);
+        auto runAway = [&fast, &t]{
+            for(; fast != t[0].end(); ++fast);
+        };
+        REQUIRE_THROWS_AS(runAway(), const lazy::MemoryBudgetExceeded&);
+        REQUIRE(fast.buffered() <= 1000);
+    }
+}